@@ -0,0 +1,46 @@
+# Helpers to build ahead of time compiled vortex programs.
+#
+#   vvm_add_aot_executable(<target> <image> [COMPARE_TEST])
+#   vvm_add_aot_library(<target> <image>)
+#
+# <image> is a program snapshot (VM::saveSnapshot). It is translated to C++
+# with vvm-aot and compiled with -O2 against libvvm. Executables get a
+# --compare mode that runs the interpreter and the compiled code side by side,
+# COMPARE_TEST registers it with ctest, which only happens if the top level
+# CMakeLists.txt calls enable_testing() (or include(CTest)). Libraries are
+# shared objects exporting vvmAotRun(VM &, Program &).
+
+function(_vvm_aot_source target image out_source)
+  get_filename_component(image "${image}" ABSOLUTE)
+  set(source "${CMAKE_CURRENT_BINARY_DIR}/${target}.aot.cpp")
+  add_custom_command(
+    OUTPUT "${source}"
+    COMMAND vvm-aot "${image}" "${source}"
+    DEPENDS vvm-aot "${image}"
+    COMMENT "Compiling ${image} ahead of time"
+    VERBATIM)
+  set(${out_source} "${source}" PARENT_SCOPE)
+endfunction()
+
+function(vvm_add_aot_executable target image)
+  cmake_parse_arguments(AOT "COMPARE_TEST" "" "" ${ARGN})
+  _vvm_aot_source(${target} "${image}" source)
+  add_executable(${target} "${source}")
+  target_link_libraries(${target} PRIVATE libvvm)
+  if(NOT MSVC)
+    target_compile_options(${target} PRIVATE -O2)
+  endif()
+  if(AOT_COMPARE_TEST)
+    add_test(NAME ${target}_matches_interpreter COMMAND ${target} --compare)
+  endif()
+endfunction()
+
+function(vvm_add_aot_library target image)
+  _vvm_aot_source(${target} "${image}" source)
+  add_library(${target} SHARED "${source}")
+  target_compile_definitions(${target} PRIVATE VVM_AOT_NO_MAIN)
+  target_link_libraries(${target} PRIVATE libvvm)
+  if(NOT MSVC)
+    target_compile_options(${target} PRIVATE -O2)
+  endif()
+endfunction()
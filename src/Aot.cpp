@@ -0,0 +1,626 @@
+#include "Aot.h"
+#include "Util.h"
+#include <charconv>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+struct StackEffect {
+  std::size_t Pops;
+  std::size_t Pushes;
+};
+
+// what the analysis knows about the VM before an instruction
+struct AbstractState {
+  // one entry per stack slot, the value if it is a known number
+  std::vector<std::optional<double>> Stack;
+  // stack slot of every local, like VM::locals_
+  std::vector<std::size_t> Locals;
+};
+
+auto stackEffect(std::uint8_t op, StackEffect &effect) -> bool {
+  switch (op) {
+  case PUSHC:
+  case PUSHC_NUM:
+  case PUSH_TRUE:
+  case PUSH_FALSE:
+  case PUSH_NIL:
+  case MAP_NEW:
+    effect = {0, 1};
+    return true;
+  case POP:
+  case PRINT:
+  case POP_LOCAL:
+  case JMP_TO:
+    effect = {1, 0};
+    return true;
+  case SAVE_GLOB:
+  case SET_LOCAL:
+  case JMP_TO_IF_FALSE:
+  case MAP_DEL:
+    effect = {2, 0};
+    return true;
+  case ARRAY_SET:
+  case MAP_SET:
+    effect = {3, 0};
+    return true;
+  case LOAD_GLOB:
+  case NOT:
+  case NEGATE:
+  case GET_LOCAL:
+  case ARRAY_NEW:
+  case ARRAY_LEN:
+  case ARRAY_SUM:
+  case ARRAY_MIN:
+  case ARRAY_MAX:
+    effect = {1, 1};
+    return true;
+  case ADD:
+  case SUB:
+  case MUL:
+  case DIV:
+  case EQ:
+  case LESS_EQ:
+  case GREATER_EQ:
+  case GREATER:
+  case LESS:
+  case ARRAY_GET:
+  case ARRAY_ADD:
+  case ARRAY_MUL:
+  case ARRAY_DOT:
+  case MAP_GET:
+  case MAP_HAS:
+    effect = {2, 1};
+    return true;
+  case ADD_LOCAL:
+  case HALT:
+    effect = {0, 0};
+    return true;
+  default:
+    return false;
+  }
+}
+
+auto opName(std::uint8_t op) -> std::string_view {
+  switch (op) {
+  case ADD:
+    return "ADD";
+  case EQ:
+    return "EQ";
+  case DIV:
+    return "DIV";
+  case PRINT:
+    return "PRINT";
+  case ARRAY_NEW:
+    return "ARRAY_NEW";
+  case ARRAY_GET:
+    return "ARRAY_GET";
+  case ARRAY_SET:
+    return "ARRAY_SET";
+  case ARRAY_LEN:
+    return "ARRAY_LEN";
+  case ARRAY_ADD:
+    return "ARRAY_ADD";
+  case ARRAY_MUL:
+    return "ARRAY_MUL";
+  case ARRAY_SUM:
+    return "ARRAY_SUM";
+  case ARRAY_MIN:
+    return "ARRAY_MIN";
+  case ARRAY_MAX:
+    return "ARRAY_MAX";
+  case ARRAY_DOT:
+    return "ARRAY_DOT";
+  case MAP_NEW:
+    return "MAP_NEW";
+  case MAP_GET:
+    return "MAP_GET";
+  case MAP_SET:
+    return "MAP_SET";
+  case MAP_HAS:
+    return "MAP_HAS";
+  case MAP_DEL:
+    return "MAP_DEL";
+  default:
+    return "INVALID_OP";
+  }
+}
+
+// an exact C++ expression for value
+auto doubleLiteral(double value) -> std::string {
+  if (std::isnan(value)) {
+    return "std::numeric_limits<double>::quiet_NaN()";
+  }
+  if (std::isinf(value)) {
+    return value < 0 ? "-std::numeric_limits<double>::infinity()"
+                     : "std::numeric_limits<double>::infinity()";
+  }
+  char digits[64];
+  auto [end, ec] = std::to_chars(digits, digits + sizeof(digits),
+                                 std::fabs(value), std::chars_format::hex);
+  auto literal = "0x" + std::string{digits, end};
+  return std::signbit(value) ? "(-" + literal + ")" : literal;
+}
+
+auto slot(std::size_t index) -> std::string {
+  return "s" + std::to_string(index);
+}
+
+class AotCompiler {
+public:
+  AotCompiler(Program const &program, AotOptions const &options)
+      : program_{program}, options_{options} {}
+
+  auto compile(std::span<std::uint8_t const> image, std::ostream &out,
+               std::string &error) -> bool;
+
+private:
+  auto analyze() -> bool;
+  auto step(std::size_t pc, AbstractState state) -> bool;
+  auto merge(std::size_t pc, AbstractState const &state) -> bool;
+  auto emitInstruction(std::size_t pc, AbstractState const &state) -> bool;
+  // call into the interpreter for op on the top pops slots
+  auto emitInvoke(std::size_t pc, std::uint8_t op, std::size_t depth,
+                  StackEffect effect) -> void;
+  // base is the depth below the operands of the failed op
+  auto emitFailure(std::size_t pc, std::size_t base) -> std::string;
+  auto operand(std::size_t pc) const -> std::uint32_t;
+  // a statically known, in range index (jump target or local)
+  auto knownIndex(std::optional<double> value, std::size_t limit,
+                  std::size_t &index) const -> bool;
+  auto fail(std::size_t pc, std::string_view what) -> bool;
+
+  Program const &program_;
+  AotOptions const &options_;
+  std::map<std::size_t, AbstractState> states_;
+  std::deque<std::size_t> worklist_;
+  std::set<std::size_t> labels_;
+  std::size_t max_depth_ = 0;
+  std::string body_;
+  std::string error_;
+};
+
+auto AotCompiler::fail(std::size_t pc, std::string_view what) -> bool {
+  error_ = "AOT: " + std::string{what} + " at offset " + std::to_string(pc) +
+           " (line " + std::to_string(program_.getLine(pc)) + ")";
+  return false;
+}
+
+auto AotCompiler::operand(std::size_t pc) const -> std::uint32_t {
+  auto &code = program_.Bytecode;
+  return (static_cast<std::uint32_t>(code[pc + 1]) << 16) |
+         (static_cast<std::uint32_t>(code[pc + 2]) << 8) | code[pc + 3];
+}
+
+auto AotCompiler::knownIndex(std::optional<double> value, std::size_t limit,
+                             std::size_t &index) const -> bool {
+  return value && asIndex(*value, limit, index);
+}
+
+auto AotCompiler::merge(std::size_t pc, AbstractState const &state) -> bool {
+  auto [it, inserted] = states_.try_emplace(pc, state);
+  if (inserted) {
+    worklist_.push_back(pc);
+    return true;
+  }
+  auto &known = it->second;
+  if (known.Stack.size() != state.Stack.size() ||
+      known.Locals != state.Locals) {
+    return fail(pc, "stack layout differs between incoming paths");
+  }
+  // numbers only stay known if every path agrees on them
+  auto changed = false;
+  for (std::size_t i = 0; i < known.Stack.size(); ++i) {
+    if (known.Stack[i] && known.Stack[i] != state.Stack[i]) {
+      known.Stack[i] = std::nullopt;
+      changed = true;
+    }
+  }
+  if (changed) {
+    worklist_.push_back(pc);
+  }
+  return true;
+}
+
+auto AotCompiler::step(std::size_t pc, AbstractState state) -> bool {
+  auto &code = program_.Bytecode;
+  if (pc >= code.size()) {
+    return fail(pc, "execution runs past the end of the bytecode");
+  }
+  auto op = code[pc];
+  auto effect = StackEffect{};
+  if (!stackEffect(op, effect)) {
+    return fail(pc, "invalid instruction");
+  }
+  auto &stack = state.Stack;
+  if (stack.size() < effect.Pops || (op == ADD_LOCAL && stack.empty())) {
+    return fail(pc, "stack underflow");
+  }
+  auto next = pc + 1;
+  auto index = std::size_t{};
+  switch (op) {
+  case PUSHC:
+  case PUSHC_NUM: {
+    if (pc + 3 >= code.size()) {
+      return fail(pc, "truncated constant operand");
+    }
+    auto constant = operand(pc);
+    if (op == PUSHC_NUM) {
+      if (constant >= program_.NumberConstants.size()) {
+        return fail(pc, "unknown constant");
+      }
+      stack.push_back(program_.NumberConstants[constant]);
+    } else {
+      if (constant >= program_.Constants.size()) {
+        return fail(pc, "unknown constant");
+      }
+      auto &value = program_.Constants[constant];
+      stack.push_back(value.Type == ValueType::DOUBLE
+                          ? std::optional{value.Value.AsDouble}
+                          : std::nullopt);
+    }
+    next = pc + 4;
+    break;
+  }
+  case ADD_LOCAL:
+    state.Locals.push_back(stack.size() - 1);
+    break;
+  case POP_LOCAL:
+    if (state.Locals.empty()) {
+      return fail(pc, "POP_LOCAL without a local");
+    }
+    state.Locals.pop_back();
+    stack.pop_back();
+    break;
+  case GET_LOCAL:
+    if (!knownIndex(stack.back(), state.Locals.size(), index) ||
+        state.Locals[index] + 1 >= stack.size()) {
+      return fail(pc, "local index is not a constant");
+    }
+    stack.back() = stack[state.Locals[index]];
+    break;
+  case SET_LOCAL:
+    if (!knownIndex(stack.back(), state.Locals.size(), index) ||
+        state.Locals[index] + 2 >= stack.size()) {
+      return fail(pc, "local index is not a constant");
+    }
+    stack[state.Locals[index]] = stack[stack.size() - 2];
+    stack.resize(stack.size() - 2);
+    break;
+  case JMP_TO:
+  case JMP_TO_IF_FALSE: {
+    if (!knownIndex(stack.back(), code.size(), index)) {
+      return fail(pc, "jump target is not a constant");
+    }
+    stack.resize(stack.size() - effect.Pops);
+    if (op == JMP_TO) {
+      labels_.insert(index);
+      return merge(index, state);
+    }
+    labels_.insert(index);
+    if (!merge(index, state)) {
+      return false;
+    }
+    break;
+  }
+  case HALT:
+    return true;
+  default:
+    stack.resize(stack.size() - effect.Pops);
+    stack.resize(stack.size() + effect.Pushes, std::nullopt);
+    break;
+  }
+  if (stack.size() > VM::stackSize()) {
+    return fail(pc, "stack overflow");
+  }
+  return merge(next, state);
+}
+
+auto AotCompiler::analyze() -> bool {
+  if (!merge(options_.EntryPC, AbstractState{})) {
+    return false;
+  }
+  while (!worklist_.empty()) {
+    auto pc = worklist_.front();
+    worklist_.pop_front();
+    if (!step(pc, states_[pc])) {
+      return false;
+    }
+  }
+  // a jump into the operand of a PUSHC would make two instructions overlap
+  auto end = std::size_t{0};
+  for (auto &[pc, state] : states_) {
+    if (pc < end) {
+      return fail(pc, "jump into the middle of an instruction");
+    }
+    auto op = program_.Bytecode[pc];
+    end = pc + (op == PUSHC || op == PUSHC_NUM ? 4 : 1);
+    max_depth_ = std::max(max_depth_, state.Stack.size() + 1);
+  }
+  return true;
+}
+
+auto AotCompiler::emitFailure(std::size_t pc, std::size_t base)
+    -> std::string {
+  return "return aotFinish(vm, vm.state(), " + std::to_string(pc) + ", " +
+         std::to_string(program_.getLine(pc)) + ", " +
+         (base > 0 ? slot(base - 1) : "std::nullopt") + ");";
+}
+
+auto AotCompiler::emitInvoke(std::size_t pc, std::uint8_t op,
+                             std::size_t depth, StackEffect effect) -> void {
+  auto base = depth - effect.Pops;
+  auto operands = std::string{};
+  for (auto i = base; i < depth; ++i) {
+    operands += (i == base ? "" : ", ") + slot(i);
+  }
+  auto call = "vm.invoke(" + std::string{opName(op)} + ", {" + operands + "})";
+  if (effect.Pushes == 0) {
+    body_ += "    " + call + ";\n    if (vm.state() != VMState::OK) {\n" +
+             "      " + emitFailure(pc, base) + "\n    }\n";
+    return;
+  }
+  body_ += "    if (auto r = " + call + ") {\n      " + slot(base) +
+           " = *r;\n    } else {\n      " + emitFailure(pc, base) +
+           "\n    }\n";
+}
+
+auto AotCompiler::emitInstruction(std::size_t pc, AbstractState const &state)
+    -> bool {
+  auto op = program_.Bytecode[pc];
+  auto depth = state.Stack.size();
+  auto effect = StackEffect{};
+  stackEffect(op, effect);
+  // top and the one below it, only meaningful if the op pops them
+  auto a = depth >= 2 ? slot(depth - 2) : std::string{};
+  auto b = depth >= 1 ? slot(depth - 1) : std::string{};
+  auto index = std::size_t{};
+
+  if (labels_.contains(pc)) {
+    body_ += "pc_" + std::to_string(pc) + ":\n";
+  }
+  body_ += "  { // " + std::to_string(pc) + ", line " +
+           std::to_string(program_.getLine(pc)) + "\n";
+  switch (op) {
+  case PUSHC: {
+    auto &constant = program_.Constants[operand(pc)];
+    body_ += "    " + slot(depth) + " = ";
+    body_ += constant.Type == ValueType::DOUBLE
+                 ? "aotNumber(" + doubleLiteral(constant.Value.AsDouble) + ")"
+                 : "program.Constants[" + std::to_string(operand(pc)) + "]";
+    body_ += ";\n";
+    break;
+  }
+  case PUSHC_NUM:
+    body_ += "    " + slot(depth) + " = aotNumber(" +
+             doubleLiteral(program_.NumberConstants[operand(pc)]) + ");\n";
+    break;
+  case PUSH_TRUE:
+  case PUSH_FALSE:
+    body_ += "    " + slot(depth) + " = aotBool(" +
+             (op == PUSH_TRUE ? "true" : "false") + ");\n";
+    break;
+  case PUSH_NIL:
+    body_ += "    " + slot(depth) + " = aotNil();\n";
+    break;
+  case POP:
+  case ADD_LOCAL:
+  case POP_LOCAL:
+    // locals are stack slots, nothing to do at runtime
+    break;
+  case ADD:
+    body_ += "    if (" + a + ".Type == ValueType::DOUBLE && " + b +
+             ".Type == ValueType::DOUBLE) {\n      " + a +
+             ".Value.AsDouble += " + b + ".Value.AsDouble;\n    } else\n";
+    emitInvoke(pc, op, depth, effect);
+    break;
+  case SUB:
+  case MUL:
+    body_ += "    " + a + " = aotNumber(" + a + ".Value.AsDouble " +
+             (op == SUB ? "-" : "*") + " " + b + ".Value.AsDouble);\n";
+    break;
+  case DIV:
+    // the interpreter reports the division by zero
+    body_ += "    if (" + b + ".Value.AsDouble == 0.0) {\n";
+    emitInvoke(pc, op, depth, {effect.Pops, 0});
+    body_ += "    }\n    " + a + " = aotNumber(" + a + ".Value.AsDouble / " +
+             b + ".Value.AsDouble);\n";
+    break;
+  case NEGATE:
+    body_ += "    " + b + " = aotNumber(-" + b + ".Value.AsDouble);\n";
+    break;
+  case NOT:
+    body_ += "    " + b + " = aotBool(!aotTruthy(" + b + "));\n";
+    break;
+  case EQ:
+    body_ += "    if (" + a + ".Type == ValueType::DOUBLE && " + b +
+             ".Type == ValueType::DOUBLE) {\n      " + a + " = aotBool(" + a +
+             ".Value.AsDouble == " + b + ".Value.AsDouble);\n    } else\n";
+    emitInvoke(pc, op, depth, effect);
+    break;
+  case LESS_EQ:
+  case GREATER_EQ:
+  case GREATER:
+  case LESS: {
+    auto comparison = op == LESS_EQ      ? "<="
+                      : op == GREATER_EQ ? ">="
+                      : op == GREATER    ? ">"
+                                         : "<";
+    body_ += "    " + a + " = aotBool(" + a + ".Value.AsDouble " + comparison +
+             " " + b + ".Value.AsDouble);\n";
+    break;
+  }
+  case LOAD_GLOB:
+    body_ += "    " + b + " = program.Globals[static_cast<std::size_t>(" + b +
+             ".Value.AsDouble)];\n";
+    break;
+  case SAVE_GLOB:
+    body_ += "    program.Globals[static_cast<std::size_t>(" + b +
+             ".Value.AsDouble)] = " + a + ";\n";
+    break;
+  case GET_LOCAL:
+    if (!knownIndex(state.Stack.back(), state.Locals.size(), index)) {
+      return fail(pc, "local index is not a constant");
+    }
+    body_ += "    " + b + " = " + slot(state.Locals[index]) + ";\n";
+    break;
+  case SET_LOCAL:
+    if (!knownIndex(state.Stack.back(), state.Locals.size(), index)) {
+      return fail(pc, "local index is not a constant");
+    }
+    body_ += "    " + slot(state.Locals[index]) + " = " + a + ";\n";
+    break;
+  case JMP_TO:
+  case JMP_TO_IF_FALSE:
+    // the analysis may have learned an index before a merge hid it
+    if (!knownIndex(state.Stack.back(), program_.Bytecode.size(), index)) {
+      return fail(pc, "jump target is not a constant");
+    }
+    body_ += op == JMP_TO ? "    goto pc_" + std::to_string(index) + ";\n"
+                          : "    if (!" + a + ".Value.AsBool) {\n      goto pc_" +
+                                std::to_string(index) + ";\n    }\n";
+    break;
+  case HALT:
+    body_ += "    return aotFinish(vm, VMState::HALTED, " + std::to_string(pc) +
+             ", " + std::to_string(program_.getLine(pc)) + ", " +
+             (depth > 0 ? b : "std::nullopt") + ");\n";
+    break;
+  default:
+    emitInvoke(pc, op, depth, effect);
+    break;
+  }
+  body_ += "  }\n";
+  return true;
+}
+
+auto AotCompiler::compile(std::span<std::uint8_t const> image,
+                          std::ostream &out, std::string &error) -> bool {
+  if (!analyze()) {
+    error = error_;
+    return false;
+  }
+  // code is emitted in bytecode order, so the entry may need a jump
+  auto entry_jump = states_.begin()->first != options_.EntryPC;
+  if (entry_jump) {
+    labels_.insert(options_.EntryPC);
+  }
+  for (auto &[pc, state] : states_) {
+    if (!emitInstruction(pc, state)) {
+      error = error_;
+      return false;
+    }
+  }
+
+  out << "// Generated by vvm-aot, do not edit.\n"
+      << "#include \"Aot.h\"\n#include <cstdint>\n#include <limits>\n\n"
+      << "static std::uint8_t const VVM_AOT_IMAGE[] = {";
+  for (std::size_t i = 0; i < image.size(); ++i) {
+    out << (i % 16 == 0 ? "\n   " : "") << " " << static_cast<int>(image[i])
+        << ",";
+  }
+  out << "\n};\n\n"
+      << "auto " << options_.FunctionName
+      << "(VM &vm, Program &program) -> RunResult {\n"
+      << "  (void)program;\n";
+  for (std::size_t i = 0; i < max_depth_; ++i) {
+    out << "  [[maybe_unused]] auto " << slot(i) << " = aotNil();\n";
+  }
+  if (entry_jump) {
+    out << "  goto pc_" << options_.EntryPC << ";\n";
+  }
+  out << body_ << "}\n\n"
+      << "#ifndef VVM_AOT_NO_MAIN\n"
+      << "auto main(int argc, char **argv) -> int {\n"
+      << "  return aotMain(argc, argv, VVM_AOT_IMAGE, &"
+      << options_.FunctionName << ");\n"
+      << "}\n"
+      << "#endif\n";
+  return out.good();
+}
+
+} // namespace
+
+auto compileToCpp(Program const &program, std::span<std::uint8_t const> image,
+                  std::ostream &out, std::string &error,
+                  AotOptions const &options) -> bool {
+  auto compiler = AotCompiler{program, options};
+  return compiler.compile(image, out, error);
+}
+
+auto aotMain(int argc, char **argv, std::span<std::uint8_t const> image,
+             AotFunction run) -> int {
+  if (argc > 1 && std::string_view{argv[1]} == "--compare") {
+    // everything observable after a run, values as text since the two runs
+    // have their own objects
+    struct Outcome {
+      RunResult Result;
+      std::string Output;
+      std::string Top;
+      std::vector<std::string> Globals;
+    };
+    auto execute = [&](bool compiled) -> Outcome {
+      auto outcome = Outcome{};
+      auto program = Program{};
+      auto sink = OutputSink{outcome.Output};
+      auto vm = VM{program, sink};
+      if (!vm.restore(image)) {
+        outcome.Result = {.State = VMState::COMPILE_ERR,
+                          .Error = "corrupt image", .PC = 0, .Line = 0,
+                          .Top = std::nullopt};
+        return outcome;
+      }
+      outcome.Result = compiled ? run(vm, program) : vm.execute();
+      outcome.Top =
+          outcome.Result.Top ? outcome.Result.Top->asString() : "none";
+      for (auto &global : program.Globals) {
+        outcome.Globals.push_back(global.asString());
+      }
+      return outcome;
+    };
+    auto describe = [](Outcome const &outcome) {
+      auto &result = outcome.Result;
+      auto text = "state " + std::to_string(static_cast<int>(result.State)) +
+                  ", line " + std::to_string(result.Line) + ", error \"" +
+                  result.Error + "\", top " + outcome.Top + "\nglobals:";
+      for (auto &global : outcome.Globals) {
+        text += " " + global;
+      }
+      return text + "\noutput:\n" + outcome.Output;
+    };
+    auto interpreted = execute(false);
+    auto compiled = execute(true);
+    if (interpreted.Result.State != compiled.Result.State ||
+        interpreted.Result.Error != compiled.Result.Error ||
+        interpreted.Result.Line != compiled.Result.Line ||
+        interpreted.Top != compiled.Top ||
+        interpreted.Globals != compiled.Globals ||
+        interpreted.Output != compiled.Output) {
+      std::cerr << "Mismatch between the interpreter and the compiled code!\n"
+                << "interpreter: " << describe(interpreted) << "\n"
+                << "compiled: " << describe(compiled) << "\n";
+      return 1;
+    }
+    std::cout << "Compiled code matches the interpreter.\n";
+    return 0;
+  }
+
+  auto program = Program{};
+  auto vm = VM{program};
+  if (!vm.restore(image)) {
+    std::cerr << "Corrupt program image!\n";
+    return 2;
+  }
+  auto result = run(vm, program);
+  if (!result.ok()) {
+    std::cerr << "Runtime error on line " << result.Line << ": "
+              << result.Error << "\n";
+    return 1;
+  }
+  return 0;
+}
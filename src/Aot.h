@@ -0,0 +1,82 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "Program.h"
+#include "VM.h"
+#include "VortexTypes.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+
+// Ahead of time compiler from Program bytecode to a C++ translation unit.
+//
+// Every instruction becomes a few lines of C++ and every jump target a
+// label. The stack depth has to be known statically at every instruction
+// (the code vortex generates always satisfies this), so each stack slot
+// becomes a local variable and locals become plain slot accesses. Jump
+// targets and local indices have to be constants for the same reason.
+// Numbers, booleans, comparisons, locals, globals and control flow run
+// inline; everything that touches objects (strings, arrays, maps, PRINT)
+// goes through VM::invoke, so the runtime is the one linked from libvvm.
+// Compiled code does not enforce the instruction, stack depth and wall clock
+// quotas, the heap quota still applies through VM::invoke.
+//
+// The generated file embeds the snapshot image it was compiled from, which
+// rebuilds constants, objects and globals at startup, and defines
+//   auto <FunctionName>(VM &vm, Program &program) -> RunResult;
+// plus a main() unless built with VVM_AOT_NO_MAIN (for shared objects).
+
+struct AotOptions {
+  std::size_t EntryPC = 0;
+  std::string FunctionName = "vvmAotRun";
+};
+
+// image is the snapshot the program comes from (see VM::snapshot). Returns
+// false with a message in error if the bytecode can't be compiled.
+auto compileToCpp(Program const &program, std::span<std::uint8_t const> image,
+                  std::ostream &out, std::string &error,
+                  AotOptions const &options = {}) -> bool;
+
+using AotFunction = auto (*)(VM &, Program &) -> RunResult;
+
+// main() of a generated binary. Runs the compiled code on stdout, or with
+// --compare runs both the interpreter and the compiled code on the image and
+// fails if their output, state, error, line, top of the stack or globals
+// differ.
+auto aotMain(int argc, char **argv, std::span<std::uint8_t const> image,
+             AotFunction run) -> int;
+
+// helpers the generated code is written in terms of
+inline auto aotNumber(double value) -> VortexValue {
+  return {.Type = ValueType::DOUBLE, .Value = {.AsDouble = value}};
+}
+
+inline auto aotBool(bool value) -> VortexValue {
+  return {.Type = ValueType::BOOL, .Value = {.AsBool = value}};
+}
+
+inline auto aotNil() -> VortexValue {
+  return {.Type = ValueType::NIL, .Value = {.AsBool = false}};
+}
+
+// same as VM::isTrue
+inline auto aotTruthy(VortexValue const &value) -> bool {
+  if (value.Type == ValueType::BOOL) {
+    return value.Value.AsBool;
+  }
+  return value.Type != ValueType::NIL;
+}
+
+// top is the compiled code's own top of the stack. A failed VM::invoke can
+// leave operands or a result on the VM's stack, which sit above it.
+inline auto aotFinish(VM &vm, VMState state, std::size_t pc, std::size_t line,
+                      std::optional<VortexValue> top) -> RunResult {
+  vm.flushOutput();
+  return {.State = state, .Error = vm.error(), .PC = pc, .Line = line,
+          .Top = vm.stackDepth() > 0 ? vm.top() : top};
+}
+
+#endif // !AOT_H
@@ -0,0 +1,155 @@
+#include "ArrayKernels.h"
+#include <cassert>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX__)
+
+// 4 doubles per register
+#define VVM_SIMD_WIDTH 4
+using Vec = __m256d;
+static inline auto vload(double const *p) -> Vec { return _mm256_loadu_pd(p); }
+static inline auto vstore(double *p, Vec v) -> void { _mm256_storeu_pd(p, v); }
+static inline auto vset(double x) -> Vec { return _mm256_set1_pd(x); }
+static inline auto vadd(Vec a, Vec b) -> Vec { return _mm256_add_pd(a, b); }
+static inline auto vmul(Vec a, Vec b) -> Vec { return _mm256_mul_pd(a, b); }
+static inline auto vmin(Vec a, Vec b) -> Vec { return _mm256_min_pd(a, b); }
+static inline auto vmax(Vec a, Vec b) -> Vec { return _mm256_max_pd(a, b); }
+
+#elif defined(__SSE2__)
+
+// 2 doubles per register
+#define VVM_SIMD_WIDTH 2
+using Vec = __m128d;
+static inline auto vload(double const *p) -> Vec { return _mm_loadu_pd(p); }
+static inline auto vstore(double *p, Vec v) -> void { _mm_storeu_pd(p, v); }
+static inline auto vset(double x) -> Vec { return _mm_set1_pd(x); }
+static inline auto vadd(Vec a, Vec b) -> Vec { return _mm_add_pd(a, b); }
+static inline auto vmul(Vec a, Vec b) -> Vec { return _mm_mul_pd(a, b); }
+static inline auto vmin(Vec a, Vec b) -> Vec { return _mm_min_pd(a, b); }
+static inline auto vmax(Vec a, Vec b) -> Vec { return _mm_max_pd(a, b); }
+
+#endif
+
+#ifdef VVM_SIMD_WIDTH
+static constexpr std::size_t WIDTH = VVM_SIMD_WIDTH;
+
+// folds the lanes of a register with op, used for the reductions
+template <typename Op>
+static inline auto horizontal(Vec v, double init, Op op) -> double {
+  double lanes[WIDTH];
+  vstore(lanes, v);
+  auto result = init;
+  for (auto lane : lanes) {
+    result = op(result, lane);
+  }
+  return result;
+}
+#endif
+
+auto arrayAdd(double const *a, double const *b, double *out, std::size_t size)
+    -> void {
+  auto i = std::size_t{0};
+#ifdef VVM_SIMD_WIDTH
+  for (; i + WIDTH <= size; i += WIDTH) {
+    vstore(out + i, vadd(vload(a + i), vload(b + i)));
+  }
+#endif
+  for (; i < size; ++i) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+auto arrayMul(double const *a, double const *b, double *out, std::size_t size)
+    -> void {
+  auto i = std::size_t{0};
+#ifdef VVM_SIMD_WIDTH
+  for (; i + WIDTH <= size; i += WIDTH) {
+    vstore(out + i, vmul(vload(a + i), vload(b + i)));
+  }
+#endif
+  for (; i < size; ++i) {
+    out[i] = a[i] * b[i];
+  }
+}
+
+auto arraySum(double const *a, std::size_t size) -> double {
+  auto i = std::size_t{0};
+  auto sum = 0.0;
+#ifdef VVM_SIMD_WIDTH
+  // two accumulators to hide the latency of the adds
+  auto acc0 = vset(0.0);
+  auto acc1 = vset(0.0);
+  for (; i + 2 * WIDTH <= size; i += 2 * WIDTH) {
+    acc0 = vadd(acc0, vload(a + i));
+    acc1 = vadd(acc1, vload(a + i + WIDTH));
+  }
+  sum = horizontal(vadd(acc0, acc1), 0.0,
+                   [](double x, double y) { return x + y; });
+#endif
+  for (; i < size; ++i) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+auto arrayMin(double const *a, std::size_t size) -> double {
+  assert(size > 0 && "arrayMin of an empty array.");
+  auto i = std::size_t{0};
+  auto result = a[0];
+#ifdef VVM_SIMD_WIDTH
+  if (size >= WIDTH) {
+    auto acc = vload(a);
+    for (i = WIDTH; i + WIDTH <= size; i += WIDTH) {
+      acc = vmin(acc, vload(a + i));
+    }
+    result = horizontal(acc, result,
+                        [](double x, double y) { return y < x ? y : x; });
+  }
+#endif
+  for (; i < size; ++i) {
+    result = a[i] < result ? a[i] : result;
+  }
+  return result;
+}
+
+auto arrayMax(double const *a, std::size_t size) -> double {
+  assert(size > 0 && "arrayMax of an empty array.");
+  auto i = std::size_t{0};
+  auto result = a[0];
+#ifdef VVM_SIMD_WIDTH
+  if (size >= WIDTH) {
+    auto acc = vload(a);
+    for (i = WIDTH; i + WIDTH <= size; i += WIDTH) {
+      acc = vmax(acc, vload(a + i));
+    }
+    result = horizontal(acc, result,
+                        [](double x, double y) { return y > x ? y : x; });
+  }
+#endif
+  for (; i < size; ++i) {
+    result = a[i] > result ? a[i] : result;
+  }
+  return result;
+}
+
+auto arrayDot(double const *a, double const *b, std::size_t size) -> double {
+  auto i = std::size_t{0};
+  auto dot = 0.0;
+#ifdef VVM_SIMD_WIDTH
+  auto acc0 = vset(0.0);
+  auto acc1 = vset(0.0);
+  for (; i + 2 * WIDTH <= size; i += 2 * WIDTH) {
+    acc0 = vadd(acc0, vmul(vload(a + i), vload(b + i)));
+    acc1 = vadd(acc1, vmul(vload(a + i + WIDTH), vload(b + i + WIDTH)));
+  }
+  dot = horizontal(vadd(acc0, acc1), 0.0,
+                   [](double x, double y) { return x + y; });
+#endif
+  for (; i < size; ++i) {
+    dot += a[i] * b[i];
+  }
+  return dot;
+}
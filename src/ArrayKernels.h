@@ -0,0 +1,20 @@
+#ifndef ARRAY_KERNELS_H
+#define ARRAY_KERNELS_H
+
+#include <cstddef>
+
+// Bulk loops behind the ARRAY_* opcodes. They use AVX when the file is built
+// with it (see VVM_ENABLE_AVX), SSE2 on any other x86-64 build and plain
+// loops everywhere else. The SIMD versions add up in a different order, so
+// sums and dot products can differ from the scalar ones in the last bits.
+auto arrayAdd(double const *a, double const *b, double *out, std::size_t size)
+    -> void;
+auto arrayMul(double const *a, double const *b, double *out, std::size_t size)
+    -> void;
+auto arraySum(double const *a, std::size_t size) -> double;
+// size must not be 0
+auto arrayMin(double const *a, std::size_t size) -> double;
+auto arrayMax(double const *a, std::size_t size) -> double;
+auto arrayDot(double const *a, double const *b, std::size_t size) -> double;
+
+#endif // !ARRAY_KERNELS_H
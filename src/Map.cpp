@@ -0,0 +1,166 @@
+#include "Map.h"
+#include <bit>
+#include <cassert>
+
+// splitmix64 finalizer, spreads doubles and pointers over the low bits the
+// table index is taken from
+static auto mix(std::uint64_t x) -> std::size_t {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return static_cast<std::size_t>(x);
+}
+
+auto MapObject::hashOf(VortexValue const &key) -> std::size_t {
+  auto hash = std::size_t{};
+  switch (key.Type) {
+  case ValueType::DOUBLE:
+    // 0.0 == -0.0 so they have to land on the same hash
+    hash = mix(key.Value.AsDouble == 0.0
+                   ? 0
+                   : std::bit_cast<std::uint64_t>(key.Value.AsDouble));
+    break;
+  case ValueType::BOOL:
+    hash = mix(key.Value.AsBool ? 2 : 1);
+    break;
+  case ValueType::NIL:
+    hash = mix(3);
+    break;
+  case ValueType::OBJECT:
+    if (key.Value.AsObject->is(ObjectType::STR)) {
+      hash = static_cast<StringObject *>(key.Value.AsObject)->hash();
+    } else {
+      hash = mix(reinterpret_cast<std::uintptr_t>(key.Value.AsObject));
+    }
+    break;
+  }
+  return hash == EMPTY_ ? 1 : hash;
+}
+
+auto MapObject::equal(VortexValue const &a, VortexValue const &b) -> bool {
+  if (a.Type != b.Type) {
+    return false;
+  }
+  switch (a.Type) {
+  case ValueType::DOUBLE:
+    return a.Value.AsDouble == b.Value.AsDouble;
+  case ValueType::BOOL:
+    return a.Value.AsBool == b.Value.AsBool;
+  case ValueType::NIL:
+    return true;
+  case ValueType::OBJECT:
+    if (a.Value.AsObject == b.Value.AsObject) {
+      return true;
+    }
+    if (a.Value.AsObject->is(ObjectType::STR) &&
+        b.Value.AsObject->is(ObjectType::STR)) {
+      return static_cast<StringObject *>(a.Value.AsObject)->view() ==
+             static_cast<StringObject *>(b.Value.AsObject)->view();
+    }
+    return false;
+  }
+  return false;
+}
+
+auto MapObject::find(VortexValue const &key, std::size_t hash) const
+    -> std::size_t {
+  assert(!hashes_.empty() && "Map lookup on an unallocated table.");
+  auto mask = hashes_.size() - 1;
+  for (auto i = hash & mask;; i = (i + 1) & mask) {
+    if (hashes_[i] == EMPTY_ ||
+        (hashes_[i] == hash && equal(entries_[i].Key, key))) {
+      return i;
+    }
+  }
+}
+
+auto MapObject::get(VortexValue const &key, VortexValue &value) const
+    -> bool {
+  if (size_ == 0) {
+    return false;
+  }
+  auto slot = find(key, hashOf(key));
+  if (hashes_[slot] == EMPTY_) {
+    return false;
+  }
+  value = entries_[slot].Value;
+  return true;
+}
+
+auto MapObject::has(VortexValue const &key) const -> bool {
+  return size_ != 0 && hashes_[find(key, hashOf(key))] != EMPTY_;
+}
+
+auto MapObject::set(VortexValue const &key, VortexValue const &value)
+    -> void {
+  // keep the load factor under 3/4 so probes stay short
+  if ((size_ + 1) * 4 > hashes_.size() * 3) {
+    grow();
+  }
+  auto hash = hashOf(key);
+  auto slot = find(key, hash);
+  if (hashes_[slot] == EMPTY_) {
+    hashes_[slot] = hash;
+    entries_[slot].Key = key;
+    ++size_;
+  }
+  entries_[slot].Value = value;
+}
+
+auto MapObject::remove(VortexValue const &key) -> bool {
+  if (size_ == 0) {
+    return false;
+  }
+  auto slot = find(key, hashOf(key));
+  if (hashes_[slot] == EMPTY_) {
+    return false;
+  }
+  // backward shift: pull later entries of the probe run into the hole as
+  // long as that doesn't move them in front of their home slot
+  auto mask = hashes_.size() - 1;
+  auto hole = slot;
+  for (auto i = (slot + 1) & mask; hashes_[i] != EMPTY_; i = (i + 1) & mask) {
+    auto home = hashes_[i] & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      hashes_[hole] = hashes_[i];
+      entries_[hole] = entries_[i];
+      hole = i;
+    }
+  }
+  hashes_[hole] = EMPTY_;
+  --size_;
+  return true;
+}
+
+auto MapObject::grow() -> void {
+  auto old_hashes = std::move(hashes_);
+  auto old_entries = std::move(entries_);
+  auto capacity = old_hashes.empty() ? MIN_CAPACITY_ : old_hashes.size() * 2;
+  hashes_.assign(capacity, EMPTY_);
+  entries_.assign(capacity, Entry{});
+  auto mask = capacity - 1;
+  for (std::size_t i = 0; i < old_hashes.size(); ++i) {
+    if (old_hashes[i] == EMPTY_) {
+      continue;
+    }
+    // keys are unique, so the first free slot is the right one
+    auto slot = old_hashes[i] & mask;
+    while (hashes_[slot] != EMPTY_) {
+      slot = (slot + 1) & mask;
+    }
+    hashes_[slot] = old_hashes[i];
+    entries_[slot] = old_entries[i];
+  }
+}
+
+auto MapObject::asString() -> std::string {
+  auto str = std::string{"{"};
+  auto first = true;
+  forEach([&](VortexValue key, VortexValue value) {
+    str += (first ? "" : ", ") + key.asString() + ": " + value.asString();
+    first = false;
+  });
+  return str + "}";
+}
@@ -0,0 +1,63 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "VortexTypes.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Runtime dictionary keyed on VortexValue. Open addressing with linear
+// probing: the hashes live in their own dense array so a probe only touches
+// an entry once the hash already matches, and deletion shifts the following
+// entries back instead of leaving tombstones. Strings compare by contents
+// and hash through their cached StringObject::hash(), other objects by
+// identity.
+struct MapObject : Object {
+  MapObject() { Type = ObjectType::MAP; }
+
+  // false (and value untouched) if the key is missing
+  auto get(VortexValue const &key, VortexValue &value) const -> bool;
+  auto set(VortexValue const &key, VortexValue const &value) -> void;
+  auto has(VortexValue const &key) const -> bool;
+  // false if the key was missing
+  auto remove(VortexValue const &key) -> bool;
+  auto size() const -> std::size_t { return size_; }
+  // memory held by the table, for the heap quota
+  auto bytes() const -> std::size_t {
+    return hashes_.size() * (sizeof(std::size_t) + sizeof(Entry));
+  }
+
+  // calls f(key, value) for every entry, in table order
+  template <typename F> auto forEach(F f) const -> void {
+    for (std::size_t i = 0; i < hashes_.size(); ++i) {
+      if (hashes_[i] != EMPTY_) {
+        f(entries_[i].Key, entries_[i].Value);
+      }
+    }
+  }
+
+  virtual auto asString() -> std::string override;
+
+private:
+  struct Entry {
+    VortexValue Key;
+    VortexValue Value;
+  };
+
+  static constexpr std::size_t EMPTY_ = 0;
+  static constexpr std::size_t MIN_CAPACITY_ = 8;
+
+  // never EMPTY_ for a real key
+  static auto hashOf(VortexValue const &key) -> std::size_t;
+  static auto equal(VortexValue const &a, VortexValue const &b) -> bool;
+  // slot holding key, or the empty slot where it would go
+  auto find(VortexValue const &key, std::size_t hash) const -> std::size_t;
+  auto grow() -> void;
+
+  std::vector<std::size_t> hashes_; // EMPTY_ marks a free slot
+  std::vector<Entry> entries_;
+  std::size_t size_ = 0;
+};
+
+#endif // !MAP_H
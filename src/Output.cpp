@@ -0,0 +1,61 @@
+#include "Output.h"
+#include <charconv>
+#include <cstring>
+
+OutputSink::OutputSink() : OutputSink(stdout) {}
+
+OutputSink::OutputSink(std::FILE *file)
+    : file_{file}, buffer_{std::make_unique<char[]>(BUFFER_SIZE)} {}
+
+OutputSink::OutputSink(std::string &memory) : memory_{&memory} {}
+
+OutputSink::~OutputSink() { flush(); }
+
+auto OutputSink::write(std::string_view text) -> void {
+  if (memory_ != nullptr) {
+    memory_->append(text);
+    return;
+  }
+  if (used_ + text.size() > BUFFER_SIZE) {
+    flush();
+    // too big to ever fit, hand it straight to the file
+    if (text.size() > BUFFER_SIZE) {
+      std::fwrite(text.data(), 1, text.size(), file_);
+      return;
+    }
+  }
+  std::memcpy(buffer_.get() + used_, text.data(), text.size());
+  used_ += text.size();
+}
+
+auto OutputSink::write(char c) -> void {
+  if (memory_ != nullptr) {
+    memory_->push_back(c);
+    return;
+  }
+  if (used_ == BUFFER_SIZE) {
+    flush();
+  }
+  buffer_[used_++] = c;
+}
+
+auto OutputSink::writeDouble(double value) -> void {
+  // fixed notation of DBL_MAX is 309 digits + 6 decimals, this is plenty
+  char digits[512];
+  auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value,
+                                 std::chars_format::fixed, 6);
+  if (ec != std::errc{}) {
+    write("nan");
+    return;
+  }
+  write(std::string_view{digits, static_cast<std::size_t>(end - digits)});
+}
+
+auto OutputSink::flush() -> void {
+  if (file_ == nullptr || used_ == 0) {
+    return;
+  }
+  std::fwrite(buffer_.get(), 1, used_, file_);
+  std::fflush(file_);
+  used_ = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Buffered destination for everything the VM prints. Writes are collected in
+// a large buffer and only handed to the underlying FILE * when the buffer
+// fills up or on an explicit flush(), so PRINT never goes through iostreams.
+// A sink can also target an in-memory string (for embedding and tests), in
+// which case the string itself acts as the buffer.
+class OutputSink {
+public:
+  static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+  // writes to stdout
+  OutputSink();
+  explicit OutputSink(std::FILE *file);
+  // appends to memory, the string must outlive the sink
+  explicit OutputSink(std::string &memory);
+  ~OutputSink();
+
+  OutputSink(OutputSink const &) = delete;
+  auto operator=(OutputSink const &) -> OutputSink & = delete;
+
+  auto write(std::string_view text) -> void;
+  auto write(char c) -> void;
+  // same formatting as std::to_string(double) but without the temporaries
+  auto writeDouble(double value) -> void;
+  auto flush() -> void;
+
+private:
+  std::FILE *file_ = nullptr;
+  std::string *memory_ = nullptr;
+  std::unique_ptr<char[]> buffer_;
+  std::size_t used_ = 0;
+};
+
+#endif // !OUTPUT_H
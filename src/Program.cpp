@@ -1,5 +1,9 @@
 #include "Program.h"
+#include "Map.h"
+#include "Snapshot.h"
 #include "VortexTypes.h"
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cstddef>
 #include <fstream>
@@ -7,27 +11,222 @@
 
 static constexpr auto UINT24_MAX = 16'777'215;
 
+// the bits that identify a non string constant within its type
+static auto constantBits(VortexValue const &value) -> std::uint64_t {
+  switch (value.Type) {
+  case ValueType::DOUBLE:
+    return std::bit_cast<std::uint64_t>(value.Value.AsDouble);
+  case ValueType::BOOL:
+    return value.Value.AsBool;
+  case ValueType::NIL:
+    return 0;
+  case ValueType::OBJECT:
+    return reinterpret_cast<std::uintptr_t>(value.Value.AsObject);
+  }
+  return 0;
+}
+
+static auto isString(VortexValue const &value) -> bool {
+  return value.Type == ValueType::OBJECT &&
+         value.Value.AsObject->is(ObjectType::STR);
+}
+
 auto Program::pushCode(std::uint8_t code, std::size_t line) -> std::size_t {
   Bytecode.push_back(code);
-  lines_.push_back(line);
+  markLine(Bytecode.size() - 1, line);
   return Bytecode.size() - 1;
 }
 
+auto Program::emitConstant(VortexValue constant) -> std::size_t {
+  auto index = addConstant(constant);
+  if (index < 0) {
+    return std::size_t(-1);
+  }
+  return emit(PUSHC, static_cast<std::uint32_t>(index));
+}
+
+auto Program::emitNumber(double constant) -> std::size_t {
+  auto index = addNumberConstant(constant);
+  if (index < 0) {
+    return std::size_t(-1);
+  }
+  return emit(PUSHC_NUM, static_cast<std::uint32_t>(index));
+}
+
+auto Program::newLabel() -> Label {
+  labels_.emplace_back();
+  return {.Id = static_cast<std::uint32_t>(labels_.size() - 1)};
+}
+
+auto Program::bindLabel(Label label) -> bool {
+  auto &state = labels_[label.Id];
+  assert(state.Offset == UNBOUND_ && "Label bound twice.");
+  state.Offset = Bytecode.size();
+  if (state.FirstPatch == UNBOUND_) {
+    return true;
+  }
+  auto index = addNumberConstant(static_cast<double>(state.Offset));
+  if (index < 0) {
+    return false;
+  }
+  for (auto patch = state.FirstPatch; patch != UNBOUND_;
+       patch = patches_[patch].Next) {
+    auto site = patches_[patch].Site;
+    Bytecode[site + 1] = static_cast<std::uint8_t>(index >> 16);
+    Bytecode[site + 2] = static_cast<std::uint8_t>(index >> 8);
+    Bytecode[site + 3] = static_cast<std::uint8_t>(index);
+    --pending_jumps_;
+  }
+  state.FirstPatch = UNBOUND_;
+  return true;
+}
+
+auto Program::emitJump(OpCode op, Label target) -> std::size_t {
+  assert((op == JMP_TO || op == JMP_TO_IF_FALSE) && "Not a jump opcode.");
+  auto &state = labels_[target.Id];
+  if (state.Offset != UNBOUND_) {
+    if (emitNumber(static_cast<double>(state.Offset)) == std::size_t(-1)) {
+      return std::size_t(-1);
+    }
+  } else {
+    // placeholder operand until bindLabel knows the target
+    patches_.push_back({.Site = emit(PUSHC_NUM, 0), .Next = state.FirstPatch});
+    state.FirstPatch = patches_.size() - 1;
+    ++pending_jumps_;
+  }
+  return emit(op);
+}
+
+auto Program::appendBlock(std::span<std::uint8_t const> code) -> std::size_t {
+  auto offset = Bytecode.size();
+  Bytecode.insert(Bytecode.end(), code.begin(), code.end());
+  if (!code.empty()) {
+    markLine(offset, line_);
+  }
+  return offset;
+}
+
+auto Program::getLine(std::size_t offset) const -> std::size_t {
+  if (offset >= Bytecode.size()) {
+    return 0;
+  }
+  auto run = std::upper_bound(
+      lines_.begin(), lines_.end(), offset,
+      [](std::size_t value, LineRun const &run) { return value < run.Offset; });
+  return run == lines_.begin() ? 0 : std::prev(run)->Line;
+}
+
 auto Program::addConstant(VortexValue constant) -> std::int32_t {
-  if (Constants.size() >= UINT24_MAX) {
-    return -1;
+  auto index = static_cast<std::int32_t>(Constants.size());
+  if (isString(constant)) {
+    auto str = static_cast<StringObject *>(constant.Value.AsObject)->view();
+    auto [it, inserted] = string_constants_.try_emplace(str, index);
+    if (!inserted) {
+      return it->second;
+    }
+    if (Constants.size() >= UINT24_MAX) {
+      string_constants_.erase(it);
+      return -1;
+    }
+  } else {
+    auto &table = value_constants_[static_cast<std::size_t>(constant.Type)];
+    auto [it, inserted] = table.try_emplace(constantBits(constant), index);
+    if (!inserted) {
+      return it->second;
+    }
+    if (Constants.size() >= UINT24_MAX) {
+      table.erase(it);
+      return -1;
+    }
   }
   Constants.push_back(constant);
-  return Constants.size() - 1;
+  return index;
+}
+
+auto Program::addNumberConstant(double constant) -> std::int32_t {
+  auto index = static_cast<std::int32_t>(NumberConstants.size());
+  auto [it, inserted] = number_constants_.try_emplace(
+      std::bit_cast<std::uint64_t>(constant), index);
+  if (!inserted) {
+    return it->second;
+  }
+  if (NumberConstants.size() >= UINT24_MAX) {
+    number_constants_.erase(it);
+    return -1;
+  }
+  NumberConstants.push_back(constant);
+  return index;
+}
+
+auto Program::indexConstants() -> void {
+  for (auto &table : value_constants_) {
+    table.clear();
+  }
+  string_constants_.clear();
+  interned_strings_.clear();
+  number_constants_.clear();
+  // try_emplace keeps the first index if an image has duplicates
+  for (std::size_t i = 0; i < Constants.size(); ++i) {
+    auto index = static_cast<std::int32_t>(i);
+    auto &constant = Constants[i];
+    if (isString(constant)) {
+      auto str = static_cast<StringObject *>(constant.Value.AsObject)->view();
+      string_constants_.try_emplace(str, index);
+      interned_strings_.try_emplace(str, constant.Value.AsObject);
+    } else {
+      value_constants_[static_cast<std::size_t>(constant.Type)].try_emplace(
+          constantBits(constant), index);
+    }
+  }
+  for (std::size_t i = 0; i < NumberConstants.size(); ++i) {
+    number_constants_.try_emplace(
+        std::bit_cast<std::uint64_t>(NumberConstants[i]),
+        static_cast<std::int32_t>(i));
+  }
 }
 
 auto Program::createString(std::string_view contents) -> Object * {
-  auto index = Objects.size();
+  heap_bytes_ += sizeof(StringObject) + contents.size();
   Objects.emplace_back(std::make_unique<StringObject>(std::string{contents}));
   Objects.back()->Type = ObjectType::STR;
   return Objects.back().get();
 }
 
+auto Program::concatStrings(StringObject *left, StringObject *right)
+    -> Object * {
+  // small results are cheaper to copy than to keep as a node
+  if (left->length() + right->length() <= ROPE_MIN_LENGTH) {
+    auto contents = std::string{left->view()};
+    contents += right->view();
+    return createString(contents);
+  }
+  heap_bytes_ += sizeof(StringObject);
+  Objects.emplace_back(std::make_unique<StringObject>(left, right));
+  return Objects.back().get();
+}
+
+auto Program::createArray(std::size_t size) -> Object * {
+  heap_bytes_ += sizeof(ArrayObject) + size * sizeof(double);
+  Objects.emplace_back(std::make_unique<ArrayObject>(size));
+  return Objects.back().get();
+}
+
+auto Program::createMap() -> Object * {
+  heap_bytes_ += sizeof(MapObject);
+  Objects.emplace_back(std::make_unique<MapObject>());
+  return Objects.back().get();
+}
+
+auto Program::internString(std::string_view contents) -> Object * {
+  if (auto it = interned_strings_.find(contents);
+      it != interned_strings_.end()) {
+    return it->second;
+  }
+  auto object = createString(contents);
+  interned_strings_[static_cast<StringObject *>(object)->Str] = object;
+  return object;
+}
+
 auto Program::dissassemble(std::string_view output_filename) -> void {
   auto output_file = std::ofstream{std::string{output_filename} + ".vbyte",
                                    std::ios_base::out};
@@ -36,6 +235,11 @@ auto Program::dissassemble(std::string_view output_filename) -> void {
   for (std::size_t i = 0; i < Constants.size(); ++i) {
     output_file << "[" << i << "] : " << Constants[i].asString() << "\n";
   }
+  output_file << "NUMBER CONSTANTS:\n";
+  for (std::size_t i = 0; i < NumberConstants.size(); ++i) {
+    output_file << "[" << i << "] : " << std::to_string(NumberConstants[i])
+                << "\n";
+  }
   // then output the bytecode
   output_file << "BYTECODE BEGINS:\n";
   for (std::size_t i = 0; i < Bytecode.size();) {
@@ -47,11 +251,16 @@ auto Program::dissassemble(std::string_view output_filename) -> void {
 auto Program::dissassembleInstruction(std::size_t &i) -> std::string {
   // TODO: just change the name to something
   // like "line" or "instruction"
-  auto codename = std::to_string(lines_[i]) + ": ";
+  auto codename = std::to_string(getLine(i)) + ": ";
   switch (Bytecode[i]) {
   case PUSHC:
+  case PUSHC_NUM:
     codename += dissassembleConstant(i);
     break;
+  case LOAD_GLOB:
+  case SAVE_GLOB:
+    codename += dissassembleGlobal(i);
+    break;
   default:
     codename += dissassembleRegular(i);
     break;
@@ -109,12 +318,6 @@ auto Program::dissassembleRegular(std::size_t &i) -> std::string {
   case PRINT:
     ++i;
     return "PRINT";
-  case SAVE_GLOB:
-    ++i;
-    return "STORE_GLOB";
-  case LOAD_GLOB:
-    ++i;
-    return "LOAD_GLOB";
   case ADD_LOCAL:
     ++i;
     return "ADD_LOCAL";
@@ -124,6 +327,12 @@ auto Program::dissassembleRegular(std::size_t &i) -> std::string {
   case GET_LOCAL:
     ++i;
     return "GET_LOCAL";
+  case POP_LOCAL:
+    ++i;
+    return "POP_LOCAL";
+  case POP:
+    ++i;
+    return "POP";
   case JMP_TO:
     ++i;
     return "JMP_TO";
@@ -131,6 +340,51 @@ auto Program::dissassembleRegular(std::size_t &i) -> std::string {
     // TODO: fix
     ++i;
     return "JMP_TO_IF_FALSE";
+  case ARRAY_NEW:
+    ++i;
+    return "ARRAY_NEW";
+  case ARRAY_GET:
+    ++i;
+    return "ARRAY_GET";
+  case ARRAY_SET:
+    ++i;
+    return "ARRAY_SET";
+  case ARRAY_LEN:
+    ++i;
+    return "ARRAY_LEN";
+  case ARRAY_ADD:
+    ++i;
+    return "ARRAY_ADD";
+  case ARRAY_MUL:
+    ++i;
+    return "ARRAY_MUL";
+  case ARRAY_SUM:
+    ++i;
+    return "ARRAY_SUM";
+  case ARRAY_MIN:
+    ++i;
+    return "ARRAY_MIN";
+  case ARRAY_MAX:
+    ++i;
+    return "ARRAY_MAX";
+  case ARRAY_DOT:
+    ++i;
+    return "ARRAY_DOT";
+  case MAP_NEW:
+    ++i;
+    return "MAP_NEW";
+  case MAP_GET:
+    ++i;
+    return "MAP_GET";
+  case MAP_SET:
+    ++i;
+    return "MAP_SET";
+  case MAP_HAS:
+    ++i;
+    return "MAP_HAS";
+  case MAP_DEL:
+    ++i;
+    return "MAP_DEL";
   }
   return "";
 }
@@ -143,18 +397,290 @@ auto Program::dissassembleConstant(std::size_t &i) -> std::string {
   auto b2 = static_cast<std::int32_t>(Bytecode[i + 2]);
   auto b3 = static_cast<std::int32_t>(Bytecode[i + 3]);
   auto constant_index = (b1 << 16) | (b2 << 8) | (b3);
-  auto instr = "PUSHC " + std::to_string(constant_index);
+  auto instr = std::string{Bytecode[i] == PUSHC_NUM ? "PUSHC_NUM " : "PUSHC "} +
+               std::to_string(constant_index);
 
   i += 4; // 4 byte instruction (instr b0, b1, b2)
   return instr + "\n extra byte \n extra byte \n extra byte";
 }
 
+auto Program::dissassembleGlobal(std::size_t &i) -> std::string {
+  auto instr =
+      std::string{Bytecode[i] == LOAD_GLOB ? "LOAD_GLOB" : "STORE_GLOB"};
+  // the index is usually pushed right before as a number constant
+  if (i >= 4 && (Bytecode[i - 4] == PUSHC || Bytecode[i - 4] == PUSHC_NUM)) {
+    auto constant_index = (static_cast<std::uint32_t>(Bytecode[i - 3]) << 16) |
+                          (static_cast<std::uint32_t>(Bytecode[i - 2]) << 8) |
+                          Bytecode[i - 1];
+    auto index = -1.0;
+    if (Bytecode[i - 4] == PUSHC_NUM &&
+        constant_index < NumberConstants.size()) {
+      index = NumberConstants[constant_index];
+    } else if (Bytecode[i - 4] == PUSHC && constant_index < Constants.size() &&
+               Constants[constant_index].Type == ValueType::DOUBLE) {
+      index = Constants[constant_index].Value.AsDouble;
+    }
+    auto name = index >= 0 ? getGlobalName(static_cast<std::size_t>(index))
+                           : std::string_view{};
+    if (!name.empty()) {
+      instr += " (" + std::string{name} + ")";
+    }
+  }
+  ++i;
+  return instr;
+}
+
+auto Program::internGlobalName(std::string_view name,
+                               std::size_t index) -> void {
+  assert(global_to_index_.contains(name) == false &&
+         "Code Generation Error: Cannot create already defined global.");
+  auto &stored = global_name_storage_.emplace_back(name);
+  global_to_index_.emplace(stored, index);
+  if (global_names_.size() <= index) {
+    global_names_.resize(index + 1);
+  }
+  global_names_[index] = stored;
+}
+
 auto Program::createGlobal(std::string_view name,
                            VortexValue val) -> std::size_t {
   auto index = Globals.size();
   Globals.push_back(val);
-  assert(global_to_index_.contains(std::string{name}) == false &&
-         "Code Generation Error: Cannot create already defined global.");
-  global_to_index_[std::string{name}] = index;
+  internGlobalName(name, index);
   return index;
 }
+
+auto Program::createGlobals(std::span<std::string_view const> names,
+                            VortexValue value) -> std::size_t {
+  auto first = Globals.size();
+  Globals.resize(first + names.size(), value);
+  global_to_index_.reserve(global_to_index_.size() + names.size());
+  global_names_.reserve(first + names.size());
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    internGlobalName(names[i], first + i);
+  }
+  return first;
+}
+
+auto Program::writeSnapshot(SnapshotWriter &writer) const -> void {
+  writer.write(static_cast<std::uint64_t>(Bytecode.size()));
+  writer.writeBytes(Bytecode.data(), Bytecode.size());
+  writer.write(static_cast<std::uint64_t>(lines_.size()));
+  for (auto const &run : lines_) {
+    writer.write(static_cast<std::uint64_t>(run.Offset));
+    writer.write(static_cast<std::uint64_t>(run.Line));
+  }
+  // objects go first so every value after them can refer to one by index
+  writer.write(static_cast<std::uint64_t>(Objects.size()));
+  for (std::size_t i = 0; i < Objects.size(); ++i) {
+    auto &object = Objects[i];
+    writer.ObjectIndices[object.get()] = static_cast<std::uint32_t>(i);
+    writer.write(static_cast<std::uint8_t>(object->Type));
+    switch (object->Type) {
+    case ObjectType::STR: {
+      // rope nodes are written as the indices of their halves, flattening
+      // every intermediate node of a loop would make the image quadratic.
+      // Halves are always older objects so they already have an index.
+      auto string = static_cast<StringObject *>(object.get());
+      if (!string->isFlat()) {
+        auto left = writer.ObjectIndices.find(string->left());
+        auto right = writer.ObjectIndices.find(string->right());
+        assert(left != writer.ObjectIndices.end() &&
+               right != writer.ObjectIndices.end() &&
+               "Rope node created before its halves.");
+        writer.write(std::uint8_t{1});
+        writer.write(left->second);
+        writer.write(right->second);
+        break;
+      }
+      writer.write(std::uint8_t{0});
+      writer.writeString(string->view());
+      break;
+    }
+    case ObjectType::ARRAY: {
+      auto &elements =
+          static_cast<ArrayObject const *>(object.get())->Elements;
+      writer.write(static_cast<std::uint64_t>(elements.size()));
+      writer.writeBytes(elements.data(), elements.size() * sizeof(double));
+      break;
+    }
+    case ObjectType::MAP:
+      // contents follow once every object has an index
+      break;
+    }
+  }
+  for (auto const &object : Objects) {
+    if (object->is(ObjectType::MAP)) {
+      auto map = static_cast<MapObject const *>(object.get());
+      writer.write(static_cast<std::uint64_t>(map->size()));
+      map->forEach([&](VortexValue const &key, VortexValue const &value) {
+        writer.writeValue(key);
+        writer.writeValue(value);
+      });
+    }
+  }
+  writer.write(static_cast<std::uint64_t>(Constants.size()));
+  for (auto const &constant : Constants) {
+    writer.writeValue(constant);
+  }
+  writer.write(static_cast<std::uint64_t>(NumberConstants.size()));
+  writer.writeBytes(NumberConstants.data(),
+                    NumberConstants.size() * sizeof(double));
+  writer.write(static_cast<std::uint64_t>(Globals.size()));
+  for (auto const &global : Globals) {
+    writer.writeValue(global);
+  }
+  writer.write(static_cast<std::uint64_t>(global_to_index_.size()));
+  for (auto const &[name, index] : global_to_index_) {
+    writer.writeString(name);
+    writer.write(static_cast<std::uint64_t>(index));
+  }
+}
+
+auto Program::readSnapshot(SnapshotReader &reader) -> bool {
+  *this = Program{};
+  auto size = std::uint64_t{};
+  if (!reader.read(size) || size > reader.remaining()) {
+    return false;
+  }
+  Bytecode.resize(size);
+  if (!reader.readBytes(Bytecode.data(), size)) {
+    return false;
+  }
+  if (!reader.read(size) || size > reader.remaining() / 16) {
+    return false;
+  }
+  lines_.resize(size);
+  for (std::size_t i = 0; i < lines_.size(); ++i) {
+    auto offset = std::uint64_t{};
+    auto line = std::uint64_t{};
+    if (!reader.read(offset) || !reader.read(line)) {
+      return false;
+    }
+    // getLine searches the runs, they have to be in order
+    if (i > 0 && offset <= lines_[i - 1].Offset) {
+      return false;
+    }
+    lines_[i] = {.Offset = offset, .Line = line};
+  }
+
+  if (!reader.read(size)) {
+    return false;
+  }
+  for (std::uint64_t i = 0; i < size; ++i) {
+    auto type = std::uint8_t{};
+    if (!reader.read(type)) {
+      return false;
+    }
+    switch (static_cast<ObjectType>(type)) {
+    case ObjectType::STR: {
+      auto rope = std::uint8_t{};
+      if (!reader.read(rope)) {
+        return false;
+      }
+      if (rope != 0) {
+        auto left = std::uint32_t{};
+        auto right = std::uint32_t{};
+        if (!reader.read(left) || !reader.read(right) ||
+            left >= reader.Objects.size() || right >= reader.Objects.size() ||
+            !reader.Objects[left]->is(ObjectType::STR) ||
+            !reader.Objects[right]->is(ObjectType::STR)) {
+          return false;
+        }
+        heap_bytes_ += sizeof(StringObject);
+        Objects.emplace_back(std::make_unique<StringObject>(
+            static_cast<StringObject *>(reader.Objects[left]),
+            static_cast<StringObject *>(reader.Objects[right])));
+        reader.Objects.push_back(Objects.back().get());
+        break;
+      }
+      auto str = std::string_view{};
+      if (!reader.readString(str)) {
+        return false;
+      }
+      reader.Objects.push_back(createString(str));
+      break;
+    }
+    case ObjectType::ARRAY: {
+      auto length = std::uint64_t{};
+      if (!reader.read(length) ||
+          length > reader.remaining() / sizeof(double)) {
+        return false;
+      }
+      auto array = createArray(length);
+      auto &elements = static_cast<ArrayObject *>(array)->Elements;
+      if (!reader.readBytes(elements.data(), length * sizeof(double))) {
+        return false;
+      }
+      reader.Objects.push_back(array);
+      break;
+    }
+    case ObjectType::MAP:
+      reader.Objects.push_back(createMap());
+      break;
+    default:
+      return false;
+    }
+  }
+
+  for (auto object : reader.Objects) {
+    if (!object->is(ObjectType::MAP)) {
+      continue;
+    }
+    auto map = static_cast<MapObject *>(object);
+    if (!reader.read(size)) {
+      return false;
+    }
+    for (std::uint64_t i = 0; i < size; ++i) {
+      auto key = VortexValue{};
+      auto value = VortexValue{};
+      if (!reader.readValue(key) || !reader.readValue(value)) {
+        return false;
+      }
+      map->set(key, value);
+    }
+    heap_bytes_ += map->bytes();
+  }
+
+  if (!reader.read(size) || size > reader.remaining()) {
+    return false;
+  }
+  Constants.resize(size);
+  for (auto &constant : Constants) {
+    if (!reader.readValue(constant)) {
+      return false;
+    }
+  }
+  if (!reader.read(size) || size > reader.remaining() / sizeof(double)) {
+    return false;
+  }
+  NumberConstants.resize(size);
+  if (!reader.readBytes(NumberConstants.data(), size * sizeof(double))) {
+    return false;
+  }
+  indexConstants();
+
+  if (!reader.read(size) || size > reader.remaining()) {
+    return false;
+  }
+  Globals.resize(size);
+  for (auto &global : Globals) {
+    if (!reader.readValue(global)) {
+      return false;
+    }
+  }
+
+  if (!reader.read(size)) {
+    return false;
+  }
+  for (std::uint64_t i = 0; i < size; ++i) {
+    auto name = std::string_view{};
+    auto index = std::uint64_t{};
+    if (!reader.readString(name) || !reader.read(index) ||
+        index >= Globals.size() || globalExists(name)) {
+      return false;
+    }
+    internGlobalName(name, index);
+  }
+  return true;
+}
@@ -5,15 +5,31 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <span>
+#include <string>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
+
+class SnapshotWriter;
+class SnapshotReader;
+
+// Jump target handed out by Program::newLabel, usable before it is bound.
+struct Label {
+  std::uint32_t Id;
+};
+
 // Represents the program in bytecode and runtime, with all user memory here
 class Program {
 public:
+  // concatenations up to this many bytes are copied instead of making a rope
+  static constexpr std::size_t ROPE_MIN_LENGTH = 64;
+
   std::vector<std::uint8_t> Bytecode;
-  std::vector<VortexValue> Constants;
+  std::vector<VortexValue> Constants; // PUSHC pool, any kind of value
+  std::vector<double> NumberConstants; // PUSHC_NUM pool, dense doubles only
   std::vector<VortexValue> Globals;
   std::vector<std::unique_ptr<Object>>
       Objects; // the VM's memory is here it's kinda weird
@@ -21,30 +37,121 @@ public:
   Program() = default;
   // returns index of byte
   auto pushCode(std::uint8_t code, std::size_t line) -> std::size_t;
+
+  // Emitter. Every emit* appends one instruction at the line given to
+  // setLine() and returns its offset. Jumps to labels that aren't bound yet
+  // get their target patched in by bindLabel.
+  auto setLine(std::size_t line) -> void { line_ = line; }
+  auto reserve(std::size_t bytes) -> void { Bytecode.reserve(bytes); }
+  // any instruction without an operand
+  auto emit(OpCode op) -> std::size_t {
+    assert(op != PUSHC && op != PUSHC_NUM && "Missing constant operand.");
+    auto offset = Bytecode.size();
+    Bytecode.push_back(op);
+    markLine(offset, line_);
+    return offset;
+  }
+  // PUSHC or PUSHC_NUM of an index into their pool
+  auto emit(OpCode op, std::uint32_t operand) -> std::size_t {
+    assert((op == PUSHC || op == PUSHC_NUM) && "Operand on a 1 byte opcode.");
+    assert(operand <= 0xffffff && "Constant index does not fit 24 bits.");
+    auto offset = Bytecode.size();
+    Bytecode.resize(offset + 4);
+    auto code = Bytecode.data() + offset;
+    code[0] = op;
+    code[1] = static_cast<std::uint8_t>(operand >> 16);
+    code[2] = static_cast<std::uint8_t>(operand >> 8);
+    code[3] = static_cast<std::uint8_t>(operand);
+    markLine(offset, line_);
+    return offset;
+  }
+  // add the constant and push it, std::size_t(-1) if its pool is full
+  auto emitConstant(VortexValue constant) -> std::size_t;
+  auto emitNumber(double constant) -> std::size_t;
+  auto newLabel() -> Label;
+  // Binds the label to the next offset and patches every jump to it, false
+  // if the number pool has no room left for the target.
+  auto bindLabel(Label label) -> bool;
+  // JMP_TO or JMP_TO_IF_FALSE to the label (the target is pushed for it)
+  auto emitJump(OpCode op, Label target) -> std::size_t;
+  // jumps still waiting for their label to be bound
+  auto pendingJumps() const -> std::size_t { return pending_jumps_; }
+  // Appends pre-encoded instructions in one go, all at the current line.
+  // Their operands must index this program's pools and jump targets are
+  // absolute, so blocks are meant to come from emitters of this program.
+  auto appendBlock(std::span<std::uint8_t const> code) -> std::size_t;
+
   // Creates a string on the objects list, returns a pointer to it's location on
   // the object store will use to create a VortexValue -> push it as a constant
   // -> access it as an Object *
   auto createString(std::string_view contents) -> Object *;
+  // left + right, as a rope node unless the result is short. A node only
+  // counts its own size towards heapBytes() until flattenString is used on it.
+  auto concatStrings(StringObject *left, StringObject *right) -> Object *;
+  // the contents of string, counting them towards heapBytes() if this is
+  // what turns a rope node flat
+  auto flattenString(StringObject *string) -> std::string_view {
+    if (!string->isFlat()) {
+      heap_bytes_ += string->length();
+    }
+    return string->view();
+  }
+  // Creates an array of size zeros on the object store
+  auto createArray(std::size_t size) -> Object *;
+  // Creates an empty map on the object store
+  auto createMap() -> Object *;
+  // Like createString but hands back the same object for the same contents,
+  // meant for literals.
+  auto internString(std::string_view contents) -> Object *;
   // TODO: rename to createConstant
+  // Constants are deduplicated: doubles by bit pattern, strings by contents
+  // and other objects by identity. Returns -1 once the pool is full.
   auto addConstant(VortexValue constant) -> std::int32_t;
+  // same as above but for the PUSHC_NUM pool
+  auto addNumberConstant(double constant) -> std::int32_t;
   auto createGlobal(std::string_view name, VortexValue value) -> std::size_t;
+  // declares every name with the same initial value, returns the index of the
+  // first one, the rest follow in order
+  auto createGlobals(std::span<std::string_view const> names,
+                     VortexValue value) -> std::size_t;
+  // approximate number of bytes held by the object store
+  auto heapBytes() const -> std::size_t { return heap_bytes_; }
+  // for objects that grow after creation
+  auto addHeapBytes(std::size_t bytes) -> void { heap_bytes_ += bytes; }
+
+  // (de)serializes everything above plus the line table and global names,
+  // reading replaces the current contents of the program, which are left
+  // half read if it fails (VM::restore reads into a fresh Program).
+  auto writeSnapshot(SnapshotWriter &writer) const -> void;
+  auto readSnapshot(SnapshotReader &reader) -> bool;
 
   auto dissassemble(std::string_view output_filename) -> void;
   auto dissassembleInstruction(std::size_t &i) -> std::string;
 
-  auto getConstant(std::uint32_t index) -> VortexValue const {
+  auto getConstant(std::uint32_t index) const -> VortexValue const & {
     return Constants[index];
   }
-  auto getGlobalIndex(std::string_view name) -> std::size_t {
-    assert(global_to_index_.contains(std::string{name}) &&
-           "Non existent global!");
-    if (!global_to_index_.contains(std::string{name})) {
+  auto getNumberConstant(std::uint32_t index) const -> double {
+    return NumberConstants[index];
+  }
+  // source line of the instruction at offset, 0 if it is out of range
+  auto getLine(std::size_t offset) const -> std::size_t;
+  // one hash probe, no allocation
+  auto getGlobalIndex(std::string_view name) const -> std::size_t {
+    auto it = global_to_index_.find(name);
+    assert(it != global_to_index_.end() && "Non existent global!");
+    if (it == global_to_index_.end()) {
       return (std::size_t(-1));
     }
-    return global_to_index_[std::string{name}];
+    return it->second;
+  }
+  auto globalExists(std::string_view name) const -> bool {
+    return global_to_index_.contains(name);
   }
-  auto globalExists(std::string_view name) -> bool const {
-    return global_to_index_.contains(std::string{name});
+  // name the global was created with, empty if it has none
+  auto getGlobalName(std::size_t index) const -> std::string_view {
+    return index < global_names_.size() ? global_names_[index]
+                                        : std::string_view{};
   }
 
 private:
@@ -52,13 +159,53 @@ private:
   auto dissassembleRegular(std::size_t &i)
       -> std::string; // Dissassemble single byte instructions
   auto dissassembleConstant(std::size_t &i)
-      -> std::string; // Dissassemble PUSHC [4 bytes]
-  auto dissassembleLoadGlobal(std::size_t &i);
-  auto dissassembleUpdateGlobal(std::size_t &i);
+      -> std::string; // Dissassemble PUSHC/PUSHC_NUM [4 bytes]
+  auto dissassembleGlobal(std::size_t &i)
+      -> std::string; // LOAD_GLOB/SAVE_GLOB, named if the index is a constant
+  auto internGlobalName(std::string_view name, std::size_t index) -> void;
+  // bytes from offset on belong to line
+  auto markLine(std::size_t offset, std::size_t line) -> void {
+    if (lines_.empty() || lines_.back().Line != line) {
+      lines_.push_back({.Offset = offset, .Line = line});
+    }
+  }
+  // rebuilds the deduplication tables from the pools
+  auto indexConstants() -> void;
 
 private:
-  std::vector<std::size_t> lines_; // TODO: more efficient storage strategy
-  std::unordered_map<std::string, std::size_t> global_to_index_;
+  // run length encoded, a run covers the bytes from its offset to the next
+  struct LineRun {
+    std::size_t Offset;
+    std::size_t Line;
+  };
+  std::vector<LineRun> lines_;
+  std::size_t line_ = 0;
+  // bound offset per label (or UNBOUND_) and the first of its pending jumps,
+  // which are chained through patches_
+  static constexpr std::size_t UNBOUND_ = std::size_t(-1);
+  struct LabelState {
+    std::size_t Offset = UNBOUND_;
+    std::size_t FirstPatch = UNBOUND_;
+  };
+  struct Patch {
+    std::size_t Site; // offset of the PUSHC_NUM
+    std::size_t Next;
+  };
+  std::vector<LabelState> labels_;
+  std::vector<Patch> patches_;
+  std::size_t pending_jumps_ = 0;
+  // names are interned in the deque (which never moves its elements), the
+  // map and the reverse table only hold views into it
+  std::deque<std::string> global_name_storage_;
+  std::unordered_map<std::string_view, std::size_t> global_to_index_;
+  std::vector<std::string_view> global_names_;
+  std::size_t heap_bytes_ = 0;
+  // deduplication tables, values are indices in the pools. Non string values
+  // are keyed on their type and bits (the pointer for objects).
+  std::unordered_map<std::uint64_t, std::int32_t> value_constants_[4];
+  std::unordered_map<std::string_view, std::int32_t> string_constants_;
+  std::unordered_map<std::uint64_t, std::int32_t> number_constants_;
+  std::unordered_map<std::string_view, Object *> interned_strings_;
 };
 
 #endif // !PROGRAM_H
@@ -0,0 +1,52 @@
+#include "Snapshot.h"
+#include <bit>
+#include <cassert>
+
+auto SnapshotWriter::writeValue(VortexValue const &value) -> void {
+  write(static_cast<std::uint8_t>(value.Type));
+  switch (value.Type) {
+  case ValueType::DOUBLE:
+    write(std::bit_cast<std::uint64_t>(value.Value.AsDouble));
+    break;
+  case ValueType::BOOL:
+    write(static_cast<std::uint64_t>(value.Value.AsBool));
+    break;
+  case ValueType::NIL:
+    write(std::uint64_t{0});
+    break;
+  case ValueType::OBJECT: {
+    auto it = ObjectIndices.find(value.Value.AsObject);
+    assert(it != ObjectIndices.end() &&
+           "Snapshot Error: Value refers to an object outside the store.");
+    write(static_cast<std::uint64_t>(it->second));
+    break;
+  }
+  }
+}
+
+auto SnapshotReader::readValue(VortexValue &value) -> bool {
+  auto type = std::uint8_t{};
+  auto payload = std::uint64_t{};
+  if (!read(type) || !read(payload)) {
+    return false;
+  }
+  switch (static_cast<ValueType>(type)) {
+  case ValueType::DOUBLE:
+    value = {.Type = ValueType::DOUBLE,
+             .Value = {.AsDouble = std::bit_cast<double>(payload)}};
+    return true;
+  case ValueType::BOOL:
+    value = {.Type = ValueType::BOOL, .Value = {.AsBool = payload != 0}};
+    return true;
+  case ValueType::NIL:
+    value = {.Type = ValueType::NIL, .Value = {.AsBool = false}};
+    return true;
+  case ValueType::OBJECT:
+    if (payload >= Objects.size()) {
+      return false;
+    }
+    value = {.Type = ValueType::OBJECT, .Value = {.AsObject = Objects[payload]}};
+    return true;
+  }
+  return false;
+}
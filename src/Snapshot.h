@@ -0,0 +1,86 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "VortexTypes.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Binary image of a Program and the VM running it. Everything is stored in
+// native byte order, object pointers are stored as indices into
+// Program::Objects and relocated on load.
+static constexpr std::uint32_t SNAPSHOT_MAGIC = 0x534d5656; // "VVMS"
+static constexpr std::uint32_t SNAPSHOT_VERSION = 7;
+
+class SnapshotWriter {
+public:
+  std::vector<std::uint8_t> Data;
+  // filled in by the Program as it writes its objects
+  std::unordered_map<Object const *, std::uint32_t> ObjectIndices;
+
+public:
+  template <typename T> auto write(T const &value) -> void {
+    static_assert(std::is_trivially_copyable_v<T>);
+    writeBytes(&value, sizeof(T));
+  }
+  auto writeBytes(void const *bytes, std::size_t size) -> void {
+    auto begin = static_cast<std::uint8_t const *>(bytes);
+    Data.insert(Data.end(), begin, begin + size);
+  }
+  auto writeString(std::string_view str) -> void {
+    write(static_cast<std::uint64_t>(str.size()));
+    writeBytes(str.data(), str.size());
+  }
+  auto writeValue(VortexValue const &value) -> void;
+};
+
+// Reads an image back, every read is bounds checked and returns false once
+// the image turns out to be truncated or corrupt.
+class SnapshotReader {
+public:
+  // filled in by the Program as it reads its objects
+  std::vector<Object *> Objects;
+
+public:
+  explicit SnapshotReader(std::span<std::uint8_t const> data) : data_{data} {}
+
+  template <typename T> auto read(T &value) -> bool {
+    static_assert(std::is_trivially_copyable_v<T>);
+    return readBytes(&value, sizeof(T));
+  }
+  auto readBytes(void *bytes, std::size_t size) -> bool {
+    if (data_.size() - position_ < size) {
+      return false;
+    }
+    std::memcpy(bytes, data_.data() + position_, size);
+    position_ += size;
+    return true;
+  }
+  // a view straight into the image, valid as long as the image is
+  auto readString(std::string_view &str) -> bool {
+    auto size = std::uint64_t{};
+    if (!read(size) || data_.size() - position_ < size) {
+      return false;
+    }
+    str = {reinterpret_cast<char const *>(data_.data() + position_),
+           static_cast<std::size_t>(size)};
+    position_ += size;
+    return true;
+  }
+  auto readValue(VortexValue &value) -> bool;
+  // lets callers reject element counts that can't possibly fit before
+  // allocating for them
+  auto remaining() const -> std::size_t { return data_.size() - position_; }
+
+private:
+  std::span<std::uint8_t const> data_;
+  std::size_t position_ = 0;
+};
+
+#endif // !SNAPSHOT_H
@@ -0,0 +1,104 @@
+#include "Trace.h"
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define VVM_HAS_TSC
+#elif defined(_M_X64)
+#include <intrin.h>
+#define VVM_HAS_TSC
+#endif
+
+TraceBuffer::TraceBuffer(std::size_t capacity)
+    : slots_{std::make_unique<Slot[]>(
+          std::bit_ceil(capacity < 2 ? std::size_t{2} : capacity))},
+      mask_{std::bit_ceil(capacity < 2 ? std::size_t{2} : capacity) - 1},
+      start_ticks_{now()}, start_time_{std::chrono::steady_clock::now()} {}
+
+auto TraceBuffer::now() -> std::uint64_t {
+#ifdef VVM_HAS_TSC
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+auto TraceBuffer::copy() const -> TraceDump {
+  auto result = TraceDump{};
+  auto elapsed = std::chrono::duration<double, std::nano>(
+                     std::chrono::steady_clock::now() - start_time_)
+                     .count();
+  if (elapsed > 0) {
+    result.TicksPerNanosecond =
+        static_cast<double>(now() - start_ticks_) / elapsed;
+  }
+
+  auto capacity = mask_ + 1;
+  auto done = done_.load(std::memory_order_acquire);
+  auto first = done > capacity ? done - capacity : 0;
+  for (auto i = first; i < done; ++i) {
+    auto &slot = slots_[i & mask_];
+    auto info = slot.Info.load(std::memory_order_relaxed);
+    result.Records.push_back(
+        {.Timestamp = slot.Timestamp.load(std::memory_order_relaxed),
+         .PC = static_cast<std::uint32_t>(info),
+         .StackDepth = static_cast<std::uint16_t>(info >> 32),
+         .Op = static_cast<std::uint8_t>(info >> 48)});
+  }
+  // records the writer started on while we were copying reuse the slots of
+  // the oldest ones we copied, those may be torn
+  std::atomic_thread_fence(std::memory_order_acquire);
+  auto started = started_.load(std::memory_order_relaxed);
+  if (started > capacity + first) {
+    auto torn = std::min<std::uint64_t>(started - capacity - first,
+                                        result.Records.size());
+    result.Records.erase(result.Records.begin(),
+                         result.Records.begin() + torn);
+  }
+  return result;
+}
+
+auto TraceBuffer::dump(std::string_view filename) const -> bool {
+  auto trace = copy();
+  auto file = std::ofstream{std::string{filename}, std::ios_base::binary};
+  auto count = static_cast<std::uint64_t>(trace.Records.size());
+  file.write(reinterpret_cast<char const *>(&TRACE_MAGIC), sizeof(TRACE_MAGIC));
+  file.write(reinterpret_cast<char const *>(&TRACE_VERSION),
+             sizeof(TRACE_VERSION));
+  file.write(reinterpret_cast<char const *>(&trace.TicksPerNanosecond),
+             sizeof(trace.TicksPerNanosecond));
+  file.write(reinterpret_cast<char const *>(&count), sizeof(count));
+  file.write(reinterpret_cast<char const *>(trace.Records.data()),
+             trace.Records.size() * sizeof(TraceRecord));
+  return file.good();
+}
+
+auto loadTrace(std::string_view filename, TraceDump &dump) -> bool {
+  auto file = std::ifstream{std::string{filename}, std::ios_base::binary};
+  auto magic = std::uint32_t{};
+  auto version = std::uint32_t{};
+  auto count = std::uint64_t{};
+  file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  file.read(reinterpret_cast<char *>(&dump.TicksPerNanosecond),
+            sizeof(dump.TicksPerNanosecond));
+  file.read(reinterpret_cast<char *>(&count), sizeof(count));
+  if (!file || magic != TRACE_MAGIC || version != TRACE_VERSION) {
+    return false;
+  }
+  // records are read one by one so a bogus count can't make us allocate
+  dump.Records.clear();
+  for (std::uint64_t i = 0; i < count; ++i) {
+    auto record = TraceRecord{};
+    if (!file.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+      return false;
+    }
+    dump.Records.push_back(record);
+  }
+  return true;
+}
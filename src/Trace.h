@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// One executed instruction, taken right before it runs.
+struct TraceRecord {
+  std::uint64_t Timestamp; // ticks, see TraceDump::TicksPerNanosecond
+  std::uint32_t PC;
+  std::uint16_t StackDepth;
+  std::uint8_t Op;
+  std::uint8_t Reserved = 0;
+};
+static_assert(sizeof(TraceRecord) == 16);
+
+static constexpr std::uint32_t TRACE_MAGIC = 0x544d5656; // "VVMT"
+static constexpr std::uint32_t TRACE_VERSION = 1;
+
+// What a dump file holds, oldest record first.
+struct TraceDump {
+  double TicksPerNanosecond = 1.0;
+  std::vector<TraceRecord> Records;
+};
+
+// Fixed size ring of the most recent instructions of one VM. Only the VM's
+// thread writes; any thread may copy or dump it at the same time without
+// locking. Slots are relaxed atomics guarded like a seqlock: the writer bumps
+// started_ before touching a slot and done_ after, and a reader drops
+// whatever started_ says may have been overwritten while it was copying.
+class TraceBuffer {
+public:
+  // capacity is rounded up to a power of two
+  explicit TraceBuffer(std::size_t capacity);
+
+  auto record(std::size_t pc, std::uint8_t op, std::size_t depth) -> void {
+    auto index = done_.load(std::memory_order_relaxed);
+    auto &slot = slots_[index & mask_];
+    started_.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.Timestamp.store(now(), std::memory_order_relaxed);
+    slot.Info.store(static_cast<std::uint32_t>(pc) |
+                        static_cast<std::uint64_t>(
+                            static_cast<std::uint16_t>(depth))
+                            << 32 |
+                        static_cast<std::uint64_t>(op) << 48,
+                    std::memory_order_relaxed);
+    done_.store(index + 1, std::memory_order_release);
+  }
+  auto copy() const -> TraceDump;
+  auto dump(std::string_view filename) const -> bool;
+
+  // cycle counter where there is one, steady_clock nanoseconds elsewhere
+  static auto now() -> std::uint64_t;
+
+private:
+  // a TraceRecord, with PC, depth and opcode packed in Info
+  struct Slot {
+    std::atomic<std::uint64_t> Timestamp;
+    std::atomic<std::uint64_t> Info;
+  };
+  std::unique_ptr<Slot[]> slots_;
+  std::size_t mask_;
+  std::atomic<std::uint64_t> started_ = 0;
+  std::atomic<std::uint64_t> done_ = 0;
+  // to turn ticks into time when dumping
+  std::uint64_t start_ticks_;
+  std::chrono::steady_clock::time_point start_time_;
+};
+
+auto loadTrace(std::string_view filename, TraceDump &dump) -> bool;
+
+#endif // !TRACE_H
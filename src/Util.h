@@ -1,6 +1,9 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include "VortexTypes.h"
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <tuple>
 
@@ -15,4 +18,22 @@ inline auto sizeToTriByte(std::size_t i)
   return {b1, b2, b3};
 }
 
+// value as an index into something of size limit, false unless it is an
+// integral number in [0, limit). Written so that NaN fails too.
+inline auto asIndex(double value, std::size_t limit, std::size_t &index)
+    -> bool {
+  if (!(value >= 0 && value < static_cast<double>(limit)) ||
+      value != std::floor(value)) {
+    return false;
+  }
+  index = static_cast<std::size_t>(value);
+  return true;
+}
+
+inline auto asIndex(VortexValue const &value, std::size_t limit,
+                    std::size_t &index) -> bool {
+  return value.Type == ValueType::DOUBLE &&
+         asIndex(value.Value.AsDouble, limit, index);
+}
+
 #endif //! UTIL_H
@@ -1,48 +1,46 @@
 #include "VM.h"
+#include "ArrayKernels.h"
+#include "Snapshot.h"
 #include "Util.h"
 #include "VortexTypes.h"
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <iostream>
 #include <ostream>
 
 #define DO_BINARY_OP
 
-static constexpr bool debug_stack = false;
+VM::VM(Program &bytecode)
+    : bytecode_{bytecode}, default_output_{std::make_unique<OutputSink>()},
+      output_{default_output_.get()} {}
 
-VM::VM(Program &bytecode) : bytecode_{bytecode} {}
+VM::VM(Program &bytecode, OutputSink &output)
+    : bytecode_{bytecode}, output_{&output} {}
 
 auto VM::run() -> VMState {
-  while (state_ == VMState::OK) {
-    state_ = executeOp();
-    if constexpr (debug_stack) {
-      std::cout << "======\n";
-      printStack();
-    }
-  }
-  switch (state_) {
+  auto result = execute();
+  switch (result.State) {
   case VMState::COMPILE_ERR:
     break;
   case VMState::RUNTIME_ERR:
-    // TODO: add support for proper error handling between both the front and
-    // the back
-    std::cerr
-        << "TODO: addd support for proper error handling. RUNTIME ERROR\n";
+    std::cerr << "Runtime error on line " << result.Line << ": "
+              << result.Error << "\n";
     break;
   case VMState::STACK_OVERFLOW:
-    std::cerr << "Stack overflow!\n";
-    break;
   case VMState::STACK_UNDERFLOW:
-    std::cerr << "Stack underflow!\n";
+  case VMState::QUOTA_EXCEEDED:
+    std::cerr << result.Error << "\n";
     break;
   case VMState::HALTED:
     std::cout << "Program finished with code: "
-              << stack_[stack_top_ - 1].asString() << "\n";
+              << (result.Top ? result.Top->asString() : "nil") << "\n";
     break;
   default:
     break;
   }
 
-  if (state_ != VMState::HALTED) {
+  if (result.State != VMState::HALTED) {
     std::cout << "Would you like to print the stack? (y/n)";
     auto c = char{};
     std::cin >> c;
@@ -51,17 +49,118 @@ auto VM::run() -> VMState {
     }
   }
 
-  return state_;
+  return result.State;
+}
+
+auto VM::execute() -> RunResult {
+  instructions_ = 0;
+  if (limits_.MaxWallTime.count() != 0) {
+    deadline_ = std::chrono::steady_clock::now() + limits_.MaxWallTime;
+  }
+  // separate loops so that running untraced doesn't pay for the check
+  if (trace_) {
+    while (state_ == VMState::OK) {
+      // an out of range PC is traced too, executeOp reports it
+      auto op = PC_ < bytecode_.Bytecode.size()
+                    ? bytecode_.Bytecode[PC_]
+                    : static_cast<std::uint8_t>(INVALID_OP);
+      trace_->record(PC_, op, stack_top_);
+      state_ = executeOp();
+      ++instructions_;
+    }
+  } else {
+    while (state_ == VMState::OK) {
+      state_ = executeOp();
+      ++instructions_;
+    }
+  }
+  // anything printed by the program has to land before the caller reports
+  output_->flush();
+  if (error_.empty()) {
+    switch (state_) {
+    case VMState::STACK_OVERFLOW:
+      error_ = "Stack overflow!";
+      break;
+    case VMState::STACK_UNDERFLOW:
+      error_ = "Stack underflow!";
+      break;
+    case VMState::RUNTIME_ERR:
+      error_ = "Runtime error!";
+      break;
+    default:
+      break;
+    }
+  }
+  if (trace_ && state_ != VMState::HALTED && !trace_dump_file_.empty()) {
+    trace_->dump(trace_dump_file_);
+  }
+
+  auto result = RunResult{.State = state_,
+                          .Error = error_,
+                          .PC = PC_,
+                          .Line = bytecode_.getLine(PC_),
+                          .Top = top()};
+  return result;
+}
+
+auto VM::reset() -> void {
+  PC_ = 0;
+  stack_top_ = 0;
+  state_ = VMState::OK;
+  error_.clear();
+  locals_.clear();
+}
+
+auto VM::setLimits(VMLimits const &limits) -> void {
+  limits_ = limits;
+  stack_limit_ = STACK_SIZE_;
+  if (limits_.MaxStackDepth != 0 && limits_.MaxStackDepth < STACK_SIZE_) {
+    stack_limit_ = limits_.MaxStackDepth;
+  }
+}
+
+auto VM::enableTrace(std::size_t capacity, std::string_view dump_on_error)
+    -> void {
+  trace_ = std::make_unique<TraceBuffer>(capacity);
+  trace_dump_file_ = dump_on_error;
+}
+
+auto VM::disableTrace() -> void {
+  trace_.reset();
+  trace_dump_file_.clear();
+}
+
+auto VM::dumpTrace(std::string_view filename) const -> bool {
+  return trace_ && trace_->dump(filename);
 }
 
 auto VM::executeOp() -> VMState {
-  switch (bytecode_.Bytecode[PC_]) {
+  // falling off the end without HALT or a corrupt image
+  if (PC_ >= bytecode_.Bytecode.size()) {
+    error_ = "PC out of range!";
+    state_ = VMState::RUNTIME_ERR;
+    return state_;
+  }
+  dispatch(bytecode_.Bytecode[PC_]);
+  // on failure the PC_ stays on the last consumed instruction so errors
+  // point at it
+  if (state_ == VMState::OK) {
+    ++PC_;
+  }
+  return state_;
+}
+
+auto VM::dispatch(std::uint8_t op) -> void {
+  switch (op) {
   case POP:
     pop();
     break;
   case PUSHC:
     pushc();
     break;
+  case PUSHC_NUM:
+    pushcNum();
+    break;
   case PUSH_TRUE:
     pushBool(true);
     break;
@@ -134,29 +233,102 @@ auto VM::executeOp() -> VMState {
   case JMP_TO_IF_FALSE:
     jmpToIfFalse();
     break;
+  case ARRAY_NEW:
+    arrayNew();
+    break;
+  case ARRAY_GET:
+    arrayGet();
+    break;
+  case ARRAY_SET:
+    arraySet();
+    break;
+  case ARRAY_LEN:
+    arrayLen();
+    break;
+  case ARRAY_ADD:
+  case ARRAY_MUL:
+    arrayElementWise(static_cast<OpCode>(op));
+    break;
+  case ARRAY_SUM:
+  case ARRAY_MIN:
+  case ARRAY_MAX:
+    arrayReduce(static_cast<OpCode>(op));
+    break;
+  case ARRAY_DOT:
+    arrayDotProduct();
+    break;
+  case MAP_NEW:
+    mapNew();
+    break;
+  case MAP_GET:
+    mapGet();
+    break;
+  case MAP_SET:
+    mapSet();
+    break;
+  case MAP_HAS:
+    mapHas();
+    break;
+  case MAP_DEL:
+    mapDel();
+    break;
   default:
     state_ = VMState::RUNTIME_ERR;
     error_ = "Invalid instruction!";
     break;
   }
-  // we do this so that the right instruction prints out when we
-  // debug the stack. The PC_ stays on the last consumed instruction.
-  if (state_ == VMState::OK) {
-    ++PC_;
+}
+
+auto VM::invoke(OpCode op, std::initializer_list<VortexValue> operands)
+    -> std::optional<VortexValue> {
+  assert(op != PUSHC && op != PUSHC_NUM && op != JMP_TO &&
+         op != JMP_TO_IF_FALSE && op != HALT &&
+         "Only stack operations can be invoked.");
+  auto base = stack_top_;
+  for (auto const &operand : operands) {
+    push(operand);
   }
-  return state_;
+  dispatch(op);
+  if (state_ != VMState::OK || stack_top_ <= base) {
+    return std::nullopt;
+  }
+  return pop();
 }
 
 auto VM::print(VortexValue value) -> void {
-  // substr removes quotes around the string.
-  // will add switching to fix it up with other objs
-  if (value.Type == ValueType::OBJECT &&
-      value.Value.AsObject->Type == ObjectType::STR) {
-    std::cout << value.asString().substr(1, value.asString().size() - 2)
-              << "\n";
-    return;
+  switch (value.Type) {
+  case ValueType::DOUBLE:
+    output_->writeDouble(value.Value.AsDouble);
+    break;
+  case ValueType::BOOL:
+    output_->write(value.Value.AsBool ? "true" : "false");
+    break;
+  case ValueType::NIL:
+    output_->write("nil");
+    break;
+  case ValueType::OBJECT:
+    // strings go out straight from their storage, without the quotes
+    if (value.Value.AsObject->is(ObjectType::STR)) {
+      if (!flattenRope(value)) {
+        return;
+      }
+      output_->write(static_cast<StringObject *>(value.Value.AsObject)->view());
+    } else {
+      // keys are flat already, they were hashed
+      if (value.Value.AsObject->is(ObjectType::MAP)) {
+        static_cast<MapObject *>(value.Value.AsObject)
+            ->forEach([&](VortexValue const &, VortexValue const &element) {
+              flattenRope(element);
+            });
+        if (state_ != VMState::OK) {
+          return;
+        }
+      }
+      output_->write(value.asString());
+    }
+    break;
   }
-  std::cout << value.asString() << "\n";
+  output_->write('\n');
 }
 
 auto VM::pushc() -> void {
@@ -171,11 +343,21 @@ auto VM::pushc() -> void {
   auto b2 = static_cast<std::int32_t>(bytecode_.Bytecode[PC_ + 2]);
   auto b3 = static_cast<std::int32_t>(bytecode_.Bytecode[PC_ + 3]);
   auto index = (b1 << 16) | (b2 << 8) | (b3); // magic stuff
-  auto constant = bytecode_.getConstant(static_cast<std::size_t>(index));
-  push(constant);
+  push(bytecode_.getConstant(static_cast<std::uint32_t>(index)));
   PC_ += 3; // the 4th gets removed in the main executeOp func
 }
 
+auto VM::pushcNum() -> void {
+  assert((PC_ + 3 < bytecode_.Bytecode.size()) &&
+         "Operand of invalid or non-existent size for instruction PUSHC_NUM!");
+  auto b1 = static_cast<std::uint32_t>(bytecode_.Bytecode[PC_ + 1]);
+  auto b2 = static_cast<std::uint32_t>(bytecode_.Bytecode[PC_ + 2]);
+  auto b3 = static_cast<std::uint32_t>(bytecode_.Bytecode[PC_ + 3]);
+  auto number = bytecode_.getNumberConstant((b1 << 16) | (b2 << 8) | b3);
+  push(VortexValue{.Type = ValueType::DOUBLE, .Value = {.AsDouble = number}});
+  PC_ += 3;
+}
+
 auto VM::pushBool(bool val) -> void {
   auto bval = VortexValue{.Type = ValueType::BOOL, .Value = {.AsBool = val}};
   push(bval);
@@ -197,7 +379,11 @@ auto VM::pop() -> VortexValue {
 
 auto VM::push(VortexValue value) -> void {
   if (!check(VMState::STACK_OVERFLOW)) {
-    state_ = VMState::HALTED;
+    if (stack_limit_ < STACK_SIZE_) {
+      exceedQuota("Stack depth limit exceeded!");
+      return;
+    }
+    state_ = VMState::STACK_OVERFLOW;
     return;
   }
   stack_[stack_top_] = value;
@@ -208,6 +394,9 @@ auto VM::add() -> void {
   // TODO: debug assertions in the vortex error format see trello for more
   auto b = pop();
   auto a = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   switch (a.Type) {
   case ValueType::OBJECT: {
     /* HANDLE ADDING OBJECTS LIKE STRINGS */
@@ -218,11 +407,19 @@ auto VM::add() -> void {
              "Code generation error: Cannot add string and non-string.");
       assert(b.Value.AsObject->Type == ObjectType::STR &&
              "Code generation error: Cannot add string and non-string.");
-      auto string_object1 = dynamic_cast<StringObject *>(a.Value.AsObject);
-      auto string_object2 = dynamic_cast<StringObject *>(b.Value.AsObject);
-      // add em all up
-      auto result =
-          bytecode_.createString(string_object1->Str + string_object2->Str);
+      auto string_object1 = static_cast<StringObject *>(a.Value.AsObject);
+      auto string_object2 = static_cast<StringObject *>(b.Value.AsObject);
+      // nothing this long could ever be flattened
+      if (static_cast<double>(string_object1->length()) +
+              static_cast<double>(string_object2->length()) >
+          static_cast<double>(std::string{}.max_size())) {
+        error_ = "String too long!";
+        state_ = VMState::RUNTIME_ERR;
+        break;
+      }
+      // add em all up, long results become a rope node
+      auto result = bytecode_.concatStrings(string_object1, string_object2);
+      checkHeapQuota();
       push(VortexValue{.Type = ValueType::OBJECT, .Value{.AsObject = result}});
       break;
     }
@@ -252,6 +449,9 @@ auto VM::add() -> void {
 auto VM::sub() -> void {
   auto b = pop();
   auto a = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   // TODO: type checking
   push(VortexValue{.Type = ValueType::DOUBLE,
                    .Value = {a.Value.AsDouble - b.Value.AsDouble}});
@@ -260,6 +460,9 @@ auto VM::sub() -> void {
 auto VM::mul() -> void {
   auto b = pop();
   auto a = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   // TODO: type checking
   push(VortexValue{.Type = ValueType::DOUBLE,
                    .Value = {a.Value.AsDouble * b.Value.AsDouble}});
@@ -268,6 +471,9 @@ auto VM::mul() -> void {
 auto VM::div() -> void {
   auto b = pop();
   auto a = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   if (b.Value.AsDouble == 0.0) {
     // division by zero is not good for the vm
     error_ = "Division by zero!";
@@ -280,6 +486,9 @@ auto VM::div() -> void {
 
 auto VM::knot() -> void {
   auto rhs = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   auto val = VortexValue{};
   val.Type = ValueType::BOOL;
   val.Value.AsBool = !isTrue(rhs);
@@ -288,6 +497,9 @@ auto VM::knot() -> void {
 
 auto VM::negate() -> void {
   auto rhs = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   push(VortexValue{.Type = ValueType::DOUBLE, .Value = {-rhs.Value.AsDouble}});
 }
 
@@ -295,19 +507,34 @@ auto VM::eq() -> void {
   // TODO: typechecking  using assert and then a dedicated static analysis
   auto b = pop();
   auto a = pop();
-  // WARNING: This doesnt check for objects yet
+  if (state_ != VMState::OK) {
+    return;
+  }
+  // WARNING: objects other than strings compare by identity
   assert(a.Type == b.Type && "Code Generation Error: A & B must be of the same "
                              "time in equality operation");
   auto val = VortexValue{};
   val.Type = ValueType::BOOL;
   val.Value.AsBool = a.Value.AsDouble == b.Value.AsDouble;
-  val.Type = ValueType::BOOL;
+  // strings compare by contents
+  if (a.Type == ValueType::OBJECT && b.Type == ValueType::OBJECT &&
+      a.Value.AsObject->is(ObjectType::STR) &&
+      b.Value.AsObject->is(ObjectType::STR)) {
+    if (!flattenRope(a) || !flattenRope(b)) {
+      return;
+    }
+    val.Value.AsBool = static_cast<StringObject *>(a.Value.AsObject)->view() ==
+                       static_cast<StringObject *>(b.Value.AsObject)->view();
+  }
   push(val);
 }
 
 auto VM::lessThanOrEqual() -> void {
   auto b = pop();
   auto a = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   assert(a.Type == b.Type && "Code Generation Error: A & B must be of the same "
                              "time in equality operation");
   assert(a.Type == ValueType::DOUBLE &&
@@ -322,6 +549,9 @@ auto VM::greaterThanOrEqual() -> void {
   // TODO: typechecking  using assert and then a dedicated static analysis
   auto b = pop();
   auto a = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   assert(a.Type == b.Type && "Code Generation Error: A & B must be of the same "
                              "time in equality operation");
   assert(a.Type == ValueType::DOUBLE &&
@@ -336,6 +566,9 @@ auto VM::greaterThanOrEqual() -> void {
 auto VM::greater() -> void {
   auto b = pop();
   auto a = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   assert(a.Type == b.Type && "Code Generation Error: A & B must be of the same "
                              "time in equality operation");
   assert(a.Type == ValueType::DOUBLE &&
@@ -352,6 +585,9 @@ auto VM::less() -> void {
   // TODO: typechecking  using assert and then a dedicated static analysis
   auto b = pop();
   auto a = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
   assert(a.Type == b.Type && "Code Generation Error: A & B must be of the same "
                              "time in equality operation");
   assert(a.Type == ValueType::DOUBLE &&
@@ -394,7 +630,7 @@ auto VM::check(VMState for_state, std::size_t expected_size) -> bool {
          "Cannot check for non-stack status states.");
   switch (for_state) {
   case VMState::STACK_OVERFLOW:
-    if (stack_top_ >= STACK_SIZE_) {
+    if (stack_top_ >= stack_limit_) {
       return false;
     }
     return true;
@@ -478,8 +714,17 @@ auto VM::jmp() -> void {
     return;
   }
   // offset bytes
-  auto offset = static_cast<std::size_t>(pop().Value.AsDouble);
-  assert(offset < bytecode_.Bytecode.size());
+  auto target = pop();
+  if (!isJumpTarget(target)) {
+    return;
+  }
+  auto offset = static_cast<std::size_t>(target.Value.AsDouble);
+  if (offset <= PC_) {
+    checkLoopQuotas();
+    if (state_ != VMState::OK) {
+      return;
+    }
+  }
   // move to the specific instruction - 1 to make it the next instruction
   PC_ = offset - 1;
 }
@@ -490,12 +735,429 @@ auto VM::jmpToIfFalse() -> void {
     return;
   }
   // offset bytes
-  auto offset = static_cast<std::size_t>(pop().Value.AsDouble);
+  auto target = pop();
   auto eval = pop().Value.AsBool;
   if (!eval) {
     // similar to jmp
-    assert(offset < bytecode_.Bytecode.size());
+    if (!isJumpTarget(target)) {
+      return;
+    }
+    auto offset = static_cast<std::size_t>(target.Value.AsDouble);
+    if (offset <= PC_) {
+      checkLoopQuotas();
+      if (state_ != VMState::OK) {
+        return;
+      }
+    }
     PC_ = offset - 1;
     return;
   }
 }
+
+auto VM::isJumpTarget(VortexValue const &target) -> bool {
+  auto offset = std::size_t{};
+  if (!asIndex(target, bytecode_.Bytecode.size(), offset)) {
+    error_ = "Jump target out of range!";
+    state_ = VMState::RUNTIME_ERR;
+    return false;
+  }
+  return true;
+}
+
+auto VM::checkLoopQuotas() -> void {
+  if (limits_.MaxInstructions != 0 &&
+      instructions_ >= limits_.MaxInstructions) {
+    exceedQuota("Instruction limit exceeded!");
+    return;
+  }
+  if (limits_.MaxWallTime.count() != 0 &&
+      ++backward_jumps_ % CLOCK_CHECK_INTERVAL_ == 0 &&
+      std::chrono::steady_clock::now() >= deadline_) {
+    exceedQuota("Wall clock limit exceeded!");
+  }
+}
+
+auto VM::checkHeapQuota() -> void {
+  if (limits_.MaxHeapBytes != 0 &&
+      bytecode_.heapBytes() > limits_.MaxHeapBytes) {
+    exceedQuota("Heap limit exceeded!");
+  }
+}
+
+auto VM::admitHeapBytes(double bytes) -> bool {
+  if (limits_.MaxHeapBytes != 0 &&
+      static_cast<double>(bytecode_.heapBytes()) + bytes >
+          static_cast<double>(limits_.MaxHeapBytes)) {
+    exceedQuota("Heap limit exceeded!");
+    return false;
+  }
+  return true;
+}
+
+auto VM::flattenRope(VortexValue const &value) -> bool {
+  if (value.Type != ValueType::OBJECT ||
+      !value.Value.AsObject->is(ObjectType::STR)) {
+    return true;
+  }
+  auto string = static_cast<StringObject *>(value.Value.AsObject);
+  if (!string->isFlat()) {
+    if (!admitHeapBytes(static_cast<double>(string->length()))) {
+      return false;
+    }
+    bytecode_.flattenString(string);
+  }
+  return true;
+}
+
+auto VM::exceedQuota(std::string_view what) -> void {
+  error_ = what;
+  state_ = VMState::QUOTA_EXCEEDED;
+}
+
+auto VM::popArray() -> ArrayObject * {
+  auto value = pop();
+  if (state_ != VMState::OK) {
+    return nullptr;
+  }
+  if (value.Type != ValueType::OBJECT ||
+      !value.Value.AsObject->is(ObjectType::ARRAY)) {
+    error_ = "Expected an array!";
+    state_ = VMState::RUNTIME_ERR;
+    return nullptr;
+  }
+  return static_cast<ArrayObject *>(value.Value.AsObject);
+}
+
+auto VM::popIndex(ArrayObject *array, std::size_t &index) -> bool {
+  auto value = pop();
+  if (state_ != VMState::OK) {
+    return false;
+  }
+  if (!asIndex(value, array->Elements.size(), index)) {
+    error_ = "Array index out of range!";
+    state_ = VMState::RUNTIME_ERR;
+    return false;
+  }
+  return true;
+}
+
+auto VM::arrayNew() -> void {
+  auto size = pop();
+  if (state_ != VMState::OK) {
+    return;
+  }
+  auto max_size = std::vector<double>{}.max_size();
+  auto count = std::size_t{};
+  if (!asIndex(size, max_size, count)) {
+    auto too_large = size.Type == ValueType::DOUBLE &&
+                     size.Value.AsDouble >= static_cast<double>(max_size);
+    error_ = too_large ? "Array size too large!"
+                       : "Array size must be a non negative integer!";
+    state_ = VMState::RUNTIME_ERR;
+    return;
+  }
+  // checked up front, the allocation itself could be what brings us down
+  if (!admitHeapBytes(sizeof(ArrayObject) +
+                      static_cast<double>(count) * sizeof(double))) {
+    return;
+  }
+  auto array = bytecode_.createArray(count);
+  push(VortexValue{.Type = ValueType::OBJECT, .Value{.AsObject = array}});
+}
+
+auto VM::arrayGet() -> void {
+  if (!check(VMState::STACK_UNDERFLOW, 2)) {
+    state_ = VMState::STACK_UNDERFLOW;
+    return;
+  }
+  // the array sits under the index
+  auto array_value = stack_[stack_top_ - 2];
+  if (array_value.Type != ValueType::OBJECT ||
+      !array_value.Value.AsObject->is(ObjectType::ARRAY)) {
+    error_ = "Expected an array!";
+    state_ = VMState::RUNTIME_ERR;
+    return;
+  }
+  auto array = static_cast<ArrayObject *>(array_value.Value.AsObject);
+  auto index = std::size_t{};
+  if (!popIndex(array, index)) {
+    return;
+  }
+  pop();
+  push(VortexValue{.Type = ValueType::DOUBLE,
+                   .Value = {.AsDouble = array->Elements[index]}});
+}
+
+auto VM::arraySet() -> void {
+  if (!check(VMState::STACK_UNDERFLOW, 3)) {
+    state_ = VMState::STACK_UNDERFLOW;
+    return;
+  }
+  auto array_value = stack_[stack_top_ - 3];
+  if (array_value.Type != ValueType::OBJECT ||
+      !array_value.Value.AsObject->is(ObjectType::ARRAY)) {
+    error_ = "Expected an array!";
+    state_ = VMState::RUNTIME_ERR;
+    return;
+  }
+  auto array = static_cast<ArrayObject *>(array_value.Value.AsObject);
+  auto index = std::size_t{};
+  if (!popIndex(array, index)) {
+    return;
+  }
+  auto value = pop();
+  pop();
+  if (value.Type != ValueType::DOUBLE) {
+    error_ = "Arrays can only hold numbers!";
+    state_ = VMState::RUNTIME_ERR;
+    return;
+  }
+  array->Elements[index] = value.Value.AsDouble;
+}
+
+auto VM::arrayLen() -> void {
+  auto array = popArray();
+  if (array == nullptr) {
+    return;
+  }
+  auto length = static_cast<double>(array->Elements.size());
+  push(VortexValue{.Type = ValueType::DOUBLE, .Value = {.AsDouble = length}});
+}
+
+auto VM::arrayElementWise(OpCode op) -> void {
+  auto b = popArray();
+  auto a = popArray();
+  if (a == nullptr || b == nullptr) {
+    return;
+  }
+  if (a->Elements.size() != b->Elements.size()) {
+    error_ = "Arrays must have the same length!";
+    state_ = VMState::RUNTIME_ERR;
+    return;
+  }
+  auto size = a->Elements.size();
+  if (!admitHeapBytes(sizeof(ArrayObject) +
+                      static_cast<double>(size) * sizeof(double))) {
+    return;
+  }
+  auto result = static_cast<ArrayObject *>(bytecode_.createArray(size));
+  if (op == ARRAY_ADD) {
+    arrayAdd(a->Elements.data(), b->Elements.data(), result->Elements.data(),
+             size);
+  } else {
+    arrayMul(a->Elements.data(), b->Elements.data(), result->Elements.data(),
+             size);
+  }
+  push(VortexValue{.Type = ValueType::OBJECT, .Value{.AsObject = result}});
+}
+
+auto VM::arrayReduce(OpCode op) -> void {
+  auto array = popArray();
+  if (array == nullptr) {
+    return;
+  }
+  auto data = array->Elements.data();
+  auto size = array->Elements.size();
+  if (op == ARRAY_SUM) {
+    push(VortexValue{.Type = ValueType::DOUBLE,
+                     .Value = {.AsDouble = arraySum(data, size)}});
+    return;
+  }
+  if (size == 0) {
+    pushNil();
+    return;
+  }
+  auto result = op == ARRAY_MIN ? arrayMin(data, size) : arrayMax(data, size);
+  push(VortexValue{.Type = ValueType::DOUBLE, .Value = {.AsDouble = result}});
+}
+
+auto VM::arrayDotProduct() -> void {
+  auto b = popArray();
+  auto a = popArray();
+  if (a == nullptr || b == nullptr) {
+    return;
+  }
+  if (a->Elements.size() != b->Elements.size()) {
+    error_ = "Arrays must have the same length!";
+    state_ = VMState::RUNTIME_ERR;
+    return;
+  }
+  auto dot = arrayDot(a->Elements.data(), b->Elements.data(),
+                      a->Elements.size());
+  push(VortexValue{.Type = ValueType::DOUBLE, .Value = {.AsDouble = dot}});
+}
+
+auto VM::peekMap(std::size_t depth) -> MapObject * {
+  if (!check(VMState::STACK_UNDERFLOW, depth)) {
+    state_ = VMState::STACK_UNDERFLOW;
+    return nullptr;
+  }
+  auto value = stack_[stack_top_ - depth];
+  if (value.Type != ValueType::OBJECT ||
+      !value.Value.AsObject->is(ObjectType::MAP)) {
+    error_ = "Expected a map!";
+    state_ = VMState::RUNTIME_ERR;
+    return nullptr;
+  }
+  return static_cast<MapObject *>(value.Value.AsObject);
+}
+
+auto VM::mapNew() -> void {
+  auto map = bytecode_.createMap();
+  checkHeapQuota();
+  push(VortexValue{.Type = ValueType::OBJECT, .Value{.AsObject = map}});
+}
+
+auto VM::mapGet() -> void {
+  auto map = peekMap(2);
+  if (map == nullptr) {
+    return;
+  }
+  // hashing the key flattens it
+  if (!flattenRope(stack_[stack_top_ - 1])) {
+    return;
+  }
+  auto key = pop();
+  pop();
+  auto value = VortexValue{.Type = ValueType::NIL, .Value = {.AsBool = false}};
+  map->get(key, value);
+  push(value);
+}
+
+auto VM::mapSet() -> void {
+  auto map = peekMap(3);
+  if (map == nullptr) {
+    return;
+  }
+  if (!flattenRope(stack_[stack_top_ - 1])) {
+    return;
+  }
+  auto key = pop();
+  auto value = pop();
+  pop();
+  auto bytes = map->bytes();
+  map->set(key, value);
+  if (map->bytes() != bytes) {
+    bytecode_.addHeapBytes(map->bytes() - bytes);
+    checkHeapQuota();
+  }
+}
+
+auto VM::mapHas() -> void {
+  auto map = peekMap(2);
+  if (map == nullptr) {
+    return;
+  }
+  if (!flattenRope(stack_[stack_top_ - 1])) {
+    return;
+  }
+  auto key = pop();
+  pop();
+  pushBool(map->has(key));
+}
+
+auto VM::mapDel() -> void {
+  auto map = peekMap(2);
+  if (map == nullptr) {
+    return;
+  }
+  if (!flattenRope(stack_[stack_top_ - 1])) {
+    return;
+  }
+  auto key = pop();
+  pop();
+  map->remove(key);
+}
+
+auto VM::snapshot() const -> std::vector<std::uint8_t> {
+  if (state_ != VMState::OK && state_ != VMState::HALTED) {
+    return {};
+  }
+  auto writer = SnapshotWriter{};
+  writer.write(SNAPSHOT_MAGIC);
+  writer.write(SNAPSHOT_VERSION);
+  bytecode_.writeSnapshot(writer);
+  auto resume_pc = state_ == VMState::HALTED ? PC_ + 1 : PC_;
+  writer.write(static_cast<std::uint64_t>(resume_pc));
+  writer.write(static_cast<std::uint64_t>(stack_top_));
+  for (std::size_t i = 0; i < stack_top_; ++i) {
+    writer.writeValue(stack_[i]);
+  }
+  writer.write(static_cast<std::uint64_t>(locals_.size()));
+  for (auto local : locals_) {
+    writer.write(static_cast<std::uint64_t>(local));
+  }
+  return std::move(writer.Data);
+}
+
+auto VM::restore(std::span<std::uint8_t const> image) -> bool {
+  // everything is parsed on the side so a corrupt image leaves the VM and
+  // its Program untouched
+  auto reader = SnapshotReader{image};
+  auto magic = std::uint32_t{};
+  auto version = std::uint32_t{};
+  auto program = Program{};
+  if (!reader.read(magic) || magic != SNAPSHOT_MAGIC ||
+      !reader.read(version) || version != SNAPSHOT_VERSION ||
+      !program.readSnapshot(reader)) {
+    return false;
+  }
+  auto pc = std::uint64_t{};
+  auto stack_top = std::uint64_t{};
+  // a PC right at the end is what a program halted on its last byte resumes
+  // at, executing it reports the PC as out of range
+  if (!reader.read(pc) || pc > program.Bytecode.size() ||
+      !reader.read(stack_top) || stack_top > STACK_SIZE_) {
+    return false;
+  }
+  auto stack = std::vector<VortexValue>(stack_top);
+  for (auto &value : stack) {
+    if (!reader.readValue(value)) {
+      return false;
+    }
+  }
+  auto local_count = std::uint64_t{};
+  if (!reader.read(local_count) || local_count > reader.remaining()) {
+    return false;
+  }
+  auto locals = std::vector<std::size_t>(local_count);
+  for (auto &local : locals) {
+    auto index = std::uint64_t{};
+    if (!reader.read(index) || index >= stack_top) {
+      return false;
+    }
+    local = index;
+  }
+
+  reset();
+  // objects are owned through unique_ptr, the values read above stay valid
+  bytecode_ = std::move(program);
+  std::copy(stack.begin(), stack.end(), stack_.begin());
+  locals_ = std::move(locals);
+  PC_ = pc;
+  stack_top_ = stack_top;
+  return true;
+}
+
+auto VM::saveSnapshot(std::string_view filename) const -> bool {
+  auto image = snapshot();
+  if (image.empty()) {
+    return false;
+  }
+  auto file = std::ofstream{std::string{filename}, std::ios_base::binary};
+  file.write(reinterpret_cast<char const *>(image.data()), image.size());
+  return file.good();
+}
+
+auto VM::loadSnapshot(std::string_view filename) -> bool {
+  auto file = std::ifstream{std::string{filename},
+                            std::ios_base::binary | std::ios_base::ate};
+  if (!file) {
+    return false;
+  }
+  // one read of the whole file, restore() then works straight off the buffer
+  auto image = std::vector<std::uint8_t>(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(image.data()), image.size());
+  return file.good() && restore(image);
+}
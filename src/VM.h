@@ -1,9 +1,19 @@
 #ifndef VM_H
 #define VM_H
 
+#include "Map.h"
+#include "Output.h"
 #include "Program.h"
+#include "Trace.h"
 #include "VortexTypes.h"
 #include <array>
+#include <chrono>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
 
 enum class VMState {
   OK,
@@ -11,19 +21,95 @@ enum class VMState {
   STACK_OVERFLOW,
   STACK_UNDERFLOW,
   COMPILE_ERR,
-  RUNTIME_ERR
+  RUNTIME_ERR,
+  QUOTA_EXCEEDED
+};
+
+// Per run quotas, 0 means unlimited. To stay off the hot path the
+// instruction count and the deadline are only checked on backward jumps (so
+// straight line code can overshoot by at most the program size), the heap on
+// allocation and the stack depth on push.
+struct VMLimits {
+  std::size_t MaxInstructions = 0;
+  std::size_t MaxHeapBytes = 0; // see Program::heapBytes()
+  std::size_t MaxStackDepth = 0;
+  std::chrono::nanoseconds MaxWallTime{0};
+};
+
+// Outcome of VM::execute. Everything an embedder needs to report a failure
+// without the VM touching stdin/stdout/stderr.
+struct RunResult {
+  VMState State;
+  std::string Error;
+  std::size_t PC;   // offset of the last executed instruction
+  std::size_t Line; // source line of that instruction
+  std::optional<VortexValue> Top; // top of the stack, if there is anything
+
+  auto ok() const -> bool { return State == VMState::HALTED; }
 };
 
 class VM {
 public:
   explicit VM(Program &bytecode);
+  // PRINT goes to the given sink instead of stdout, it must outlive the VM
+  VM(Program &bytecode, OutputSink &output);
+  // runs the program and reports on the terminal, prompting on failure
   auto run() -> VMState;
+  // runs the program without doing any I/O other than PRINT into the sink
+  auto execute() -> RunResult;
+  // rewinds to the start of the program so the VM can be run again
+  auto reset() -> void;
+  // applies to every following execute()/run()
+  auto setLimits(VMLimits const &limits) -> void;
+  // Captures the stack, locals, PC and the whole Program (globals, constants
+  // and objects included). A VM that halted is captured as resuming right
+  // after its HALT, so a program can run its setup, halt, be snapshotted and
+  // later restored straight into the code that follows. Only OK or HALTED
+  // VMs can be captured, an empty image is returned otherwise.
+  auto snapshot() const -> std::vector<std::uint8_t>;
+  // replaces the VM and Program state with the image, false if it is corrupt
+  auto restore(std::span<std::uint8_t const> image) -> bool;
+  auto saveSnapshot(std::string_view filename) const -> bool;
+  auto loadSnapshot(std::string_view filename) -> bool;
   auto printStack() -> void;
+  // Runs a single stack operation on the given operands (pushed in order)
+  // and returns what it left on the stack, if anything. Errors show up in
+  // state()/error(). This is the runtime ahead of time compiled code calls
+  // into for everything it doesn't do inline.
+  auto invoke(OpCode op, std::initializer_list<VortexValue> operands)
+      -> std::optional<VortexValue>;
+  auto state() const -> VMState { return state_; }
+  auto error() const -> std::string const & { return error_; }
+  auto pc() const -> std::size_t { return PC_; }
+  auto stackDepth() const -> std::size_t { return stack_top_; }
+  auto top() const -> std::optional<VortexValue> {
+    if (stack_top_ == 0) {
+      return std::nullopt;
+    }
+    return stack_[stack_top_ - 1];
+  }
+  static constexpr auto stackSize() -> std::size_t { return STACK_SIZE_; }
+  auto setOutput(OutputSink &output) -> void { output_ = &output; }
+  auto flushOutput() -> void { output_->flush(); }
+  // Records PC, opcode, stack depth and a timestamp of the last capacity
+  // executed instructions, for a few ns each. When dump_on_error is given the
+  // trace is written there whenever execute() ends in anything but HALTED.
+  // tools/vvm-trace.cpp replays dumps against the program.
+  auto enableTrace(std::size_t capacity, std::string_view dump_on_error = {})
+      -> void;
+  auto disableTrace() -> void;
+  // Can be called from another thread while the VM runs, but not while
+  // enableTrace/disableTrace replace the buffer.
+  auto dumpTrace(std::string_view filename) const -> bool;
+  auto trace() const -> TraceBuffer const * { return trace_.get(); }
 
 private:
   auto executeOp() -> VMState;
+  // executes op without touching the PC
+  auto dispatch(std::uint8_t op) -> void;
   // instructions implementations
   auto pushc() -> void; // loads a constant
+  auto pushcNum() -> void; // loads a constant from the number pool
   auto push(VortexValue value) -> void;
   auto pop() -> VortexValue;
   auto add() -> void;
@@ -49,9 +135,42 @@ private:
   auto popLocal() -> void;
   auto jmp() -> void;
   auto jmpToIfFalse() -> void;
+  auto arrayNew() -> void;
+  auto arrayGet() -> void;
+  auto arraySet() -> void;
+  auto arrayLen() -> void;
+  // ARRAY_ADD, ARRAY_MUL
+  auto arrayElementWise(OpCode op) -> void;
+  // ARRAY_SUM, ARRAY_MIN, ARRAY_MAX
+  auto arrayReduce(OpCode op) -> void;
+  auto arrayDotProduct() -> void;
+  auto mapNew() -> void;
+  auto mapGet() -> void;
+  auto mapSet() -> void;
+  auto mapHas() -> void;
+  auto mapDel() -> void;
   // safety
   // returns true if the state is ok.
   auto check(VMState for_state, std::size_t expected_size = 0) -> bool;
+  // quotas, these set QUOTA_EXCEEDED and the error message when hit
+  auto checkLoopQuotas() -> void;
+  auto checkHeapQuota() -> void;
+  // before allocations too big to make first and check after, false if bytes
+  // more would go over the heap quota
+  auto admitHeapBytes(double bytes) -> bool;
+  // flattens value if it is a rope node, false if its contents would go over
+  // the heap quota. Anything that needs a string's contents goes through it.
+  auto flattenRope(VortexValue const &value) -> bool;
+  auto exceedQuota(std::string_view what) -> void;
+  // a runtime error unless target is a valid offset to jump to
+  auto isJumpTarget(VortexValue const &target) -> bool;
+  // pops an array, nullptr and a runtime error if it's something else
+  auto popArray() -> ArrayObject *;
+  // pops an array index, checked against the array's bounds
+  auto popIndex(ArrayObject *array, std::size_t &index) -> bool;
+  // the map sitting depth values below the top, nullptr and a runtime error
+  // if it's something else
+  auto peekMap(std::size_t depth) -> MapObject *;
   // global variables stuff
   auto loadGlobal(std::size_t index) -> void;
   auto updateGlobal(std::size_t index) -> void; // Give the global a new value
@@ -67,14 +186,28 @@ private:
 
 private:
   static constexpr std::size_t STACK_SIZE_ = 2048;
+  // how many backward jumps happen between two reads of the clock
+  static constexpr std::size_t CLOCK_CHECK_INTERVAL_ = 64;
   std::size_t PC_ = 0;
   std::size_t stack_top_ = 0;
   VMState state_ = VMState::OK;
   Program &bytecode_;
+  // only allocated when printing to stdout
+  std::unique_ptr<OutputSink> default_output_;
+  OutputSink *output_ = nullptr;
   std::array<VortexValue, STACK_SIZE_> stack_;
   std::string error_;
   // local variables are just indicies on a stack
   std::vector<std::size_t> locals_;
+  // quotas
+  VMLimits limits_;
+  std::size_t stack_limit_ = STACK_SIZE_;
+  std::size_t instructions_ = 0;
+  std::size_t backward_jumps_ = 0;
+  std::chrono::steady_clock::time_point deadline_;
+  // tracing, off unless enableTrace was called
+  std::unique_ptr<TraceBuffer> trace_;
+  std::string trace_dump_file_;
 };
 
 #endif // !VM_H
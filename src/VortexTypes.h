@@ -1,8 +1,12 @@
 #ifndef VORTEX_TYPES_H
 #define VORTEX_TYPES_H
 
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 enum OpCode : std::uint8_t {
   PUSHC = 0, // load constant
@@ -31,24 +35,119 @@ enum OpCode : std::uint8_t {
   JMP_TO,
   JMP_TO_IF_FALSE,
   HALT,
+  // new opcodes go below so existing encodings keep their values
+  PUSHC_NUM, // load constant from the number pool
+  // arrays, the array is always pushed first
+  ARRAY_NEW, // [size] -> array of zeros
+  ARRAY_GET, // [array, index] -> element
+  ARRAY_SET, // [array, value, index] -> nothing
+  ARRAY_LEN, // [array] -> length
+  ARRAY_ADD, // [a, b] -> new array, element wise a + b
+  ARRAY_MUL, // [a, b] -> new array, element wise a * b
+  ARRAY_SUM, // [array] -> sum
+  ARRAY_MIN, // [array] -> smallest element, nil if empty
+  ARRAY_MAX, // [array] -> largest element, nil if empty
+  ARRAY_DOT, // [a, b] -> dot product
+  // maps, the map is always pushed first
+  MAP_NEW, // [] -> empty map
+  MAP_GET, // [map, key] -> value, nil if missing
+  MAP_SET, // [map, value, key] -> nothing
+  MAP_HAS, // [map, key] -> bool
+  MAP_DEL, // [map, key] -> nothing
   INVALID_OP
 };
 
 enum class ValueType : std::uint8_t { DOUBLE, BOOL, NIL, OBJECT };
-enum class ObjectType : std::uint8_t { STR };
+enum class ObjectType : std::uint8_t { STR, ARRAY, MAP };
 
 struct Object {
   ObjectType Type;
 
-  auto is(ObjectType type) -> bool { return Type == type; }
+  virtual ~Object() = default;
+  auto is(ObjectType type) const -> bool { return Type == type; }
   virtual auto asString() -> std::string { return "object"; }
 };
 
+// A string is either flat (Str holds the contents) or a rope node made by
+// concatenation, which only points at its two halves. Ropes are flattened in
+// place the first time their contents are needed (view(), hash(), printing,
+// equality) so s = s + piece in a loop stays linear.
 struct StringObject : Object {
-  explicit StringObject(std::string_view s) : Str{s} { Type = ObjectType::STR; }
+  explicit StringObject(std::string_view s) : Str{s}, length_{s.size()} {
+    Type = ObjectType::STR;
+  }
+  StringObject(StringObject *left, StringObject *right)
+      : length_{left->length() + right->length()}, left_{left},
+        right_{right} {
+    Type = ObjectType::STR;
+  }
 
+  // only holds the contents once flat, read through view() instead
   std::string Str;
-  virtual auto asString() -> std::string override { return "\"" + Str + "\""; }
+  virtual auto asString() -> std::string override {
+    return "\"" + std::string{view()} + "\"";
+  }
+  auto length() const -> std::size_t { return length_; }
+  auto isFlat() const -> bool { return left_ == nullptr; }
+  // the halves of a rope node, nullptr once flat
+  auto left() const -> StringObject * { return left_; }
+  auto right() const -> StringObject * { return right_; }
+  auto view() -> std::string_view {
+    if (!isFlat()) {
+      flatten();
+    }
+    return Str;
+  }
+  // computed on first use and cached, so map lookups never rehash
+  auto hash() -> std::size_t {
+    if (!has_hash_) {
+      hash_ = std::hash<std::string_view>{}(view());
+      has_hash_ = true;
+    }
+    return hash_;
+  }
+
+private:
+  // walks the tree without recursion, ropes built in a loop are as deep as
+  // the loop is long
+  auto flatten() -> void {
+    Str.reserve(length_);
+    auto pending = std::vector<StringObject *>{right_, left_};
+    while (!pending.empty()) {
+      auto node = pending.back();
+      pending.pop_back();
+      if (node->isFlat()) {
+        Str += node->Str;
+      } else {
+        pending.push_back(node->right_);
+        pending.push_back(node->left_);
+      }
+    }
+    left_ = nullptr;
+    right_ = nullptr;
+  }
+
+  std::size_t length_;
+  StringObject *left_ = nullptr;
+  StringObject *right_ = nullptr;
+  std::size_t hash_ = 0;
+  bool has_hash_ = false;
+};
+
+// dense, unboxed doubles
+struct ArrayObject : Object {
+  explicit ArrayObject(std::size_t size) : Elements(size, 0.0) {
+    Type = ObjectType::ARRAY;
+  }
+
+  std::vector<double> Elements;
+  virtual auto asString() -> std::string override {
+    auto str = std::string{"["};
+    for (std::size_t i = 0; i < Elements.size(); ++i) {
+      str += (i == 0 ? "" : ", ") + std::to_string(Elements[i]);
+    }
+    return str + "]";
+  }
 };
 
 struct VortexValue {
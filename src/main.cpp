@@ -4,27 +4,34 @@
 
 auto main(int, char **) -> int {
   auto prog = Program{};
-  auto ptr = prog.createString("Hello World");
-  prog.addConstant({.Type = ValueType::DOUBLE, .Value = {.AsDouble = 0.0}});
-  prog.addConstant({.Type = ValueType::DOUBLE, .Value = {.AsDouble = 67.0}});
-  auto index = prog.createGlobal(
+  auto hi = prog.createGlobal(
       "hi", {.Type = ValueType::DOUBLE, .Value = {.AsDouble = 5.0}});
-  prog.pushCode(PUSHC, 0);
-  prog.pushCode(0, 0);
-  prog.pushCode(0, 0);
-  prog.pushCode(0, 0);
-  prog.pushCode(PUSHC, 0);
-  prog.pushCode(0, 0);
-  prog.pushCode(0, 0);
-  prog.pushCode(1, 1);
-  prog.pushCode(SAVE_GLOB, 0);
-  prog.pushCode(PUSHC, 0);
-  prog.pushCode(0, 0);
-  prog.pushCode(0, 0);
-  prog.pushCode(0, 0);
-  prog.pushCode(LOAD_GLOB, 0);
-  prog.pushCode(PRINT, 0);
-  prog.pushCode(HALT, 0);
+  auto greeting = VortexValue{.Type = ValueType::OBJECT,
+                              .Value = {.AsObject =
+                                            prog.internString("Hello World")}};
+  auto skip = prog.newLabel();
+
+  prog.setLine(1);
+  prog.emitConstant(greeting);
+  prog.emit(PRINT);
+  // hi = 67
+  prog.setLine(2);
+  prog.emitNumber(67.0);
+  prog.emitNumber(static_cast<double>(hi));
+  prog.emit(SAVE_GLOB);
+  // if (false) print hi
+  prog.setLine(3);
+  prog.emit(PUSH_FALSE);
+  prog.emitJump(JMP_TO_IF_FALSE, skip);
+  prog.emitNumber(static_cast<double>(hi));
+  prog.emit(LOAD_GLOB);
+  prog.emit(PRINT);
+  prog.bindLabel(skip);
+  prog.setLine(4);
+  prog.emitNumber(static_cast<double>(hi));
+  prog.emit(LOAD_GLOB);
+  prog.emit(HALT);
+
   prog.dissassemble("bytecode");
   auto vM = VM{prog};
   vM.run();
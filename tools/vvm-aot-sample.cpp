@@ -0,0 +1,233 @@
+#include "Program.h"
+#include "VM.h"
+#include "VortexTypes.h"
+#include <iostream>
+#include <string_view>
+
+// vvm-aot-sample <image>
+// Writes the image of a program that goes through every kind of code the
+// ahead of time compiler handles: locals, loops and branches, globals,
+// strings long enough to become ropes, arrays and maps. The build compiles it
+// with vvm-aot and ctest runs it with --compare against the interpreter.
+
+namespace {
+
+auto number(double value) -> VortexValue {
+  return {.Type = ValueType::DOUBLE, .Value = {.AsDouble = value}};
+}
+
+auto string(Program &program, std::string_view contents) -> VortexValue {
+  return {.Type = ValueType::OBJECT,
+          .Value = {.AsObject = program.internString(contents)}};
+}
+
+// locals
+constexpr double I = 0;
+constexpr double ACC = 1;
+constexpr double A = 2;
+constexpr double B = 3;
+constexpr double M = 4;
+
+auto getLocal(Program &program, double local) -> void {
+  program.emitNumber(local);
+  program.emit(GET_LOCAL);
+}
+
+auto setLocal(Program &program, double local) -> void {
+  program.emitNumber(local);
+  program.emit(SET_LOCAL);
+}
+
+auto loadGlobal(Program &program, std::size_t global) -> void {
+  program.emitNumber(static_cast<double>(global));
+  program.emit(LOAD_GLOB);
+}
+
+auto saveGlobal(Program &program, std::size_t global) -> void {
+  program.emitNumber(static_cast<double>(global));
+  program.emit(SAVE_GLOB);
+}
+
+auto build(Program &program) -> void {
+  auto total = program.createGlobal("total", number(0));
+  auto text = program.createGlobal("text", string(program, ""));
+  auto table = program.createGlobal("table", number(0));
+  auto doubled = program.createGlobal("doubled", number(0));
+
+  // var i = 0; var acc = 0;
+  program.setLine(1);
+  program.emitNumber(0);
+  program.emit(ADD_LOCAL);
+  program.emitNumber(0);
+  program.emit(ADD_LOCAL);
+
+  // while (i < 10) { acc = acc + i * 2; text = text + piece; i = i + 1; }
+  auto loop = program.newLabel();
+  auto done = program.newLabel();
+  program.setLine(2);
+  program.bindLabel(loop);
+  getLocal(program, I);
+  program.emitNumber(10);
+  program.emit(LESS);
+  program.emitJump(JMP_TO_IF_FALSE, done);
+  program.setLine(3);
+  getLocal(program, ACC);
+  getLocal(program, I);
+  program.emitNumber(2);
+  program.emit(MUL);
+  program.emit(ADD);
+  setLocal(program, ACC);
+  program.setLine(4);
+  loadGlobal(program, text);
+  program.emitConstant(string(program, "a piece of a longer string, "));
+  program.emit(ADD);
+  saveGlobal(program, text);
+  program.setLine(5);
+  getLocal(program, I);
+  program.emitNumber(1);
+  program.emit(ADD);
+  setLocal(program, I);
+  program.emitJump(JMP_TO, loop);
+  program.bindLabel(done);
+
+  // print acc; total = acc;
+  program.setLine(6);
+  getLocal(program, ACC);
+  program.emit(PRINT);
+  getLocal(program, ACC);
+  saveGlobal(program, total);
+
+  // if (acc == 90) print "equal"; else print "different";
+  auto otherwise = program.newLabel();
+  auto end = program.newLabel();
+  program.setLine(7);
+  getLocal(program, ACC);
+  program.emitNumber(90);
+  program.emit(EQ);
+  program.emitJump(JMP_TO_IF_FALSE, otherwise);
+  program.emitConstant(string(program, "equal"));
+  program.emit(PRINT);
+  program.emitJump(JMP_TO, end);
+  program.bindLabel(otherwise);
+  program.emitConstant(string(program, "different"));
+  program.emit(PRINT);
+  program.bindLabel(end);
+
+  // print text; print text == text;
+  program.setLine(8);
+  loadGlobal(program, text);
+  program.emit(PRINT);
+  loadGlobal(program, text);
+  loadGlobal(program, text);
+  program.emit(EQ);
+  program.emit(PRINT);
+
+  // var a = array(4); a[0] = 1.5; a[3] = -2; var b = a + a;
+  program.setLine(9);
+  program.emitNumber(4);
+  program.emit(ARRAY_NEW);
+  program.emit(ADD_LOCAL);
+  getLocal(program, A);
+  program.emitNumber(1.5);
+  program.emitNumber(0);
+  program.emit(ARRAY_SET);
+  getLocal(program, A);
+  program.emitNumber(-2);
+  program.emitNumber(3);
+  program.emit(ARRAY_SET);
+  getLocal(program, A);
+  getLocal(program, A);
+  program.emit(ARRAY_ADD);
+  program.emit(ADD_LOCAL);
+
+  // print sum(b), min(b), max(b), dot(a, b), len(a * b), b[3]
+  program.setLine(10);
+  for (auto op : {ARRAY_SUM, ARRAY_MIN, ARRAY_MAX}) {
+    getLocal(program, B);
+    program.emit(op);
+    program.emit(PRINT);
+  }
+  getLocal(program, A);
+  getLocal(program, B);
+  program.emit(ARRAY_DOT);
+  program.emit(PRINT);
+  getLocal(program, A);
+  getLocal(program, B);
+  program.emit(ARRAY_MUL);
+  program.emit(ARRAY_LEN);
+  program.emit(PRINT);
+  getLocal(program, B);
+  program.emitNumber(3);
+  program.emit(ARRAY_GET);
+  program.emit(PRINT);
+  getLocal(program, B);
+  saveGlobal(program, doubled);
+
+  // var m = {}; m["one"] = 1; m["text"] = text; m[text] = 2;
+  program.setLine(11);
+  program.emit(MAP_NEW);
+  program.emit(ADD_LOCAL);
+  getLocal(program, M);
+  program.emitNumber(1);
+  program.emitConstant(string(program, "one"));
+  program.emit(MAP_SET);
+  getLocal(program, M);
+  loadGlobal(program, text);
+  program.emitConstant(string(program, "text"));
+  program.emit(MAP_SET);
+  getLocal(program, M);
+  program.emitNumber(2);
+  loadGlobal(program, text);
+  program.emit(MAP_SET);
+
+  // print m["one"], has(m, "two"), m[text]; delete m["one"]; print m;
+  program.setLine(12);
+  getLocal(program, M);
+  program.emitConstant(string(program, "one"));
+  program.emit(MAP_GET);
+  program.emit(PRINT);
+  getLocal(program, M);
+  program.emitConstant(string(program, "two"));
+  program.emit(MAP_HAS);
+  program.emit(PRINT);
+  getLocal(program, M);
+  loadGlobal(program, text);
+  program.emit(MAP_GET);
+  program.emit(PRINT);
+  getLocal(program, M);
+  program.emitConstant(string(program, "one"));
+  program.emit(MAP_DEL);
+  getLocal(program, M);
+  program.emit(PRINT);
+  getLocal(program, M);
+  saveGlobal(program, table);
+
+  // end of scope, then leave a value behind to compare
+  program.setLine(13);
+  for (auto local = 0; local < 5; ++local) {
+    program.emit(POP_LOCAL);
+  }
+  program.emitNumber(42);
+  program.emit(HALT);
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  if (argc != 2) {
+    std::cerr << "usage: vvm-aot-sample <image>\n";
+    return 2;
+  }
+  auto program = Program{};
+  build(program);
+  if (program.pendingJumps() != 0) {
+    std::cerr << "Unbound labels in the sample program.\n";
+    return 1;
+  }
+  auto vm = VM{program};
+  if (!vm.saveSnapshot(argv[1])) {
+    std::cerr << "Could not write " << argv[1] << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,35 @@
+#include "Aot.h"
+#include "Program.h"
+#include "VM.h"
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// vvm-aot <image> <output.cpp>
+// Compiles a snapshot image (see VM::saveSnapshot) into a C++ translation
+// unit, execution starts where the snapshot would resume.
+auto main(int argc, char **argv) -> int {
+  if (argc != 3) {
+    std::cerr << "usage: vvm-aot <image> <output.cpp>\n";
+    return 2;
+  }
+  auto program = Program{};
+  auto vm = VM{program};
+  if (!vm.loadSnapshot(argv[1])) {
+    std::cerr << "Could not load program image " << argv[1] << "\n";
+    return 1;
+  }
+  if (vm.stackDepth() != 0) {
+    std::cerr << "Only images with an empty stack can be compiled.\n";
+    return 1;
+  }
+  auto image = vm.snapshot();
+  auto output = std::ofstream{argv[2]};
+  auto error = std::string{};
+  if (!compileToCpp(program, image, output,
+                    error, {.EntryPC = vm.pc(), .FunctionName = "vvmAotRun"})) {
+    std::cerr << error << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include "Program.h"
+#include "Trace.h"
+#include "VM.h"
+#include <array>
+#include <bit>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+
+// vvm-trace [--summary] <trace> <image>
+// Replays a trace dump (see VM::enableTrace) against the program image it was
+// recorded on: every instruction with its source line, the time until the
+// next one and the stack depth, then a timing histogram per opcode.
+
+namespace {
+
+// log2 buckets, the last one takes everything above
+constexpr std::size_t BUCKETS = 24;
+
+struct OpStats {
+  std::string Name;
+  std::size_t Count = 0;
+  double Total = 0.0;
+  std::array<std::size_t, BUCKETS> Histogram{};
+};
+
+// "line: INSTR ..." with the operand bytes the disassembler lists dropped
+auto describe(Program &program, std::size_t pc) -> std::string {
+  if (pc >= program.Bytecode.size()) {
+    return "?: <outside of the program>";
+  }
+  auto text = program.dissassembleInstruction(pc);
+  return text.substr(0, text.find('\n'));
+}
+
+auto opName(std::string_view description) -> std::string {
+  auto start = description.find(": ");
+  start = start == std::string_view::npos ? 0 : start + 2;
+  auto name = description.substr(start);
+  return std::string{name.substr(0, name.find(' '))};
+}
+
+auto bucketOf(double nanoseconds) -> std::size_t {
+  if (nanoseconds < 1.0) {
+    return 0;
+  }
+  auto bucket = static_cast<std::size_t>(
+      std::bit_width(static_cast<std::uint64_t>(nanoseconds)));
+  return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+auto printHistogram(OpStats const &stats) -> void {
+  std::printf("%-12s %10zu executions, %12.1f ns total, %8.1f ns mean\n",
+              stats.Name.c_str(), stats.Count, stats.Total,
+              stats.Count ? stats.Total / static_cast<double>(stats.Count)
+                          : 0.0);
+  auto most = std::size_t{1};
+  for (auto count : stats.Histogram) {
+    most = count > most ? count : most;
+  }
+  for (std::size_t i = 0; i < BUCKETS; ++i) {
+    if (stats.Histogram[i] == 0) {
+      continue;
+    }
+    auto low = i == 0 ? 0ULL : 1ULL << (i - 1);
+    auto bar = std::string(stats.Histogram[i] * 40 / most, '#');
+    std::printf("  %9llu ns %s %10zu %s\n", low,
+                i == BUCKETS - 1 ? "+ " : "..", stats.Histogram[i],
+                bar.c_str());
+  }
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  auto summary = argc == 4 && std::string_view{argv[1]} == "--summary";
+  if (argc != 3 && !summary) {
+    std::cerr << "usage: vvm-trace [--summary] <trace> <image>\n";
+    return 2;
+  }
+  auto trace_file = argv[argc - 2];
+  auto image_file = argv[argc - 1];
+
+  auto trace = TraceDump{};
+  if (!loadTrace(trace_file, trace)) {
+    std::cerr << "Could not load trace " << trace_file << "\n";
+    return 1;
+  }
+  auto program = Program{};
+  auto vm = VM{program};
+  if (!vm.loadSnapshot(image_file)) {
+    std::cerr << "Could not load program image " << image_file << "\n";
+    return 1;
+  }
+
+  auto descriptions = std::map<std::uint32_t, std::string>{};
+  auto stats = std::map<std::uint8_t, OpStats>{};
+  auto &records = trace.Records;
+  if (!summary) {
+    std::printf("%10s %8s %10s %6s  %s\n", "#", "pc", "ns", "depth",
+                "line: instruction");
+  }
+  for (std::size_t i = 0; i < records.size(); ++i) {
+    auto &record = records[i];
+    auto [it, inserted] = descriptions.try_emplace(record.PC);
+    if (inserted) {
+      it->second = describe(program, record.PC);
+    }
+    // the last record has nothing after it to be timed against
+    auto last = i + 1 == records.size();
+    auto nanoseconds =
+        last ? 0.0
+             : static_cast<double>(records[i + 1].Timestamp -
+                                   record.Timestamp) /
+                   trace.TicksPerNanosecond;
+    if (!last) {
+      auto &op = stats[record.Op];
+      if (op.Name.empty()) {
+        op.Name = opName(it->second);
+      }
+      ++op.Count;
+      op.Total += nanoseconds;
+      ++op.Histogram[bucketOf(nanoseconds)];
+    }
+    if (!summary) {
+      if (last) {
+        std::printf("%10zu %8u %10s %6u  %s\n", i, record.PC, "-",
+                    record.StackDepth, it->second.c_str());
+      } else {
+        std::printf("%10zu %8u %10.1f %6u  %s\n", i, record.PC, nanoseconds,
+                    record.StackDepth, it->second.c_str());
+      }
+    }
+  }
+
+  std::printf("\n%zu instructions traced\n", records.size());
+  for (auto &[op, op_stats] : stats) {
+    printHistogram(op_stats);
+  }
+  return 0;
+}